@@ -0,0 +1,126 @@
+#include "benchmark.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include "acceleration/SIMD.h"
+
+RaySet randomRays(const AABB& box, int count, unsigned seed) {
+    glm::vec3 center = box.centroid();
+    float size = glm::length(box.maxBounds - box.minBounds);
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> uniform(-1, 1);
+    RaySet rays;
+    for (int i = 0; i < count; i++) {
+        glm::vec3 direction = glm::normalize(glm::vec3(uniform(rng), uniform(rng), uniform(rng)));
+        glm::vec3 target = center + 0.3f * size * glm::vec3(uniform(rng), uniform(rng), uniform(rng));
+        rays.origins.push_back(glm::vec4(target - 2.0f * size * direction, 1));
+        rays.directions.push_back(glm::vec4(direction, 0));
+    }
+    return rays;
+}
+
+RaySet cameraRays(const AABB& box, int width, int height) {
+    glm::vec3 center = box.centroid();
+    float size = glm::length(box.maxBounds - box.minBounds);
+    glm::vec3 eye = center + size * glm::vec3(0.2f, 0.3f, 1.5f);
+
+    // Image plane at distance 1 with a field of view that just covers the box
+    glm::vec3 w = glm::normalize(center - eye);
+    glm::vec3 u = glm::normalize(glm::cross(w, glm::vec3(0, 1, 0)));
+    glm::vec3 v = glm::cross(u, w);
+    float halfHeight = 0.45f;
+    float halfWidth = halfHeight * width / height;
+
+    RaySet rays;
+    for (int tileY = 0; tileY < height; tileY += 4) {
+        for (int tileX = 0; tileX < width; tileX += 4) {
+            for (int j = tileY; j < std::min(tileY + 4, height); j++) {
+                for (int i = tileX; i < std::min(tileX + 4, width); i++) {
+                    float x = (2 * (i + 0.5f) / width - 1) * halfWidth;
+                    float y = (1 - 2 * (j + 0.5f) / height) * halfHeight;
+                    rays.origins.push_back(glm::vec4(eye, 1));
+                    rays.directions.push_back(glm::vec4(glm::normalize(w + x * u + y * v), 0));
+                }
+            }
+        }
+    }
+    return rays;
+}
+
+const Mesh& bunnyMesh() {
+    static const Mesh mesh = loadMesh(SCENEFILES_DIR "/intersect/meshes/bunny.obj");
+    return mesh;
+}
+
+AABB meshBounds(const Mesh& mesh) {
+    AABB box;
+    for (const glm::vec3& vertex : mesh.vertices) {
+        box.extend(vertex);
+    }
+    return box;
+}
+
+float intersectTriangle(const Mesh& mesh, int face, const Ray& ray) {
+    const Face& f = mesh.faces[face];
+    glm::vec3 v0 = mesh.vertices[f.v[0]];
+    glm::vec3 e1 = mesh.vertices[f.v[1]] - v0;
+    glm::vec3 e2 = mesh.vertices[f.v[2]] - v0;
+    glm::vec3 d(ray.direction);
+
+    glm::vec3 p = glm::cross(d, e2);
+    float det = glm::dot(e1, p);
+    if (std::fabs(det) < 1e-9f) {
+        return -1;
+    }
+    float invDet = 1 / det;
+    glm::vec3 s = glm::vec3(ray.origin) - v0;
+    float u = glm::dot(s, p) * invDet;
+    if (u < 0 || u > 1) {
+        return -1;
+    }
+    glm::vec3 q = glm::cross(s, e1);
+    float v = glm::dot(d, q) * invDet;
+    if (v < 0 || u + v > 1) {
+        return -1;
+    }
+    return glm::dot(e2, q) * invDet;
+}
+
+double bestTime(const std::function<void()>& run, int repetitions) {
+    double best = INFINITY;
+    for (int i = 0; i < repetitions; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+// Runs all benchmarks, or the ones whose names are given as arguments
+int main(int argc, char* argv[]) {
+    struct Benchmark {
+        const char* name;
+        void (*run)();
+    };
+    const Benchmark benchmarks[] = {
+        {"linear-bvh", benchmarkLinearBVH},
+        {"bvh-width", benchmarkBVHWidth},
+        {"primitives", benchmarkPrimitives},
+    };
+
+    std::printf("SIMD kernels: %s\n", simdLevelName(activeSIMDLevel()));
+    for (const Benchmark& benchmark : benchmarks) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; i++) {
+            selected |= std::strcmp(argv[i], benchmark.name) == 0;
+        }
+        if (selected) {
+            std::printf("\n== %s ==\n", benchmark.name);
+            benchmark.run();
+        }
+    }
+    return 0;
+}
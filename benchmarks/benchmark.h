@@ -0,0 +1,38 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+#include "acceleration/AABB.h"
+#include "primitive/mesh.h"
+#include "utils/ray.h"
+
+// Rays given by their origins and directions, generated once so that every benchmark run traces the same rays
+struct RaySet {
+    std::vector<glm::vec4> origins;
+    std::vector<glm::vec4> directions;
+
+    int size() const { return static_cast<int>(origins.size()); }
+    Ray ray(int i) const { return Ray(origins[i], directions[i]); }
+};
+
+// Rays from random directions through random points of the central part of a box, starting outside of the box
+RaySet randomRays(const AABB& box, int count, unsigned seed);
+
+// Rays of a pinhole camera looking at the center of a box, ordered in 4x4 pixel tiles like the primary ray packets
+RaySet cameraRays(const AABB& box, int width, int height);
+
+// The bunny mesh of the intersect scenes and its bounds
+const Mesh& bunnyMesh();
+AABB meshBounds(const Mesh& mesh);
+
+// Möller–Trumbore test of a ray against a triangle of a mesh, returns the hit distance or -1
+float intersectTriangle(const Mesh& mesh, int face, const Ray& ray);
+
+// Shortest time in seconds of a few runs of a function
+double bestTime(const std::function<void()>& run, int repetitions = 3);
+
+// Benchmarks, each prints a table of its results
+void benchmarkBVHWidth();
+void benchmarkLinearBVH();
+void benchmarkPrimitives();
@@ -0,0 +1,84 @@
+#include "benchmark.h"
+
+#include <chrono>
+#include <cstdio>
+#include "acceleration/BVH.h"
+
+// Binary vs 4-wide vs 8-wide BVH over the bunny, and primary ray packets vs single rays for each width
+// Note: Random rays use the SIMD triangle test of the leaves (closestTriangle, anyTriangle). The camera rays are
+//       traced with the same scalar triangle test by closestHit and closestHitPacket, so only the traversals differ.
+void benchmarkBVHWidth() {
+    const Mesh& mesh = bunnyMesh();
+    const AABB bounds = meshBounds(mesh);
+    const RaySet random = randomRays(bounds, 400000, 7);
+    const RaySet camera = cameraRays(bounds, 512, 512);
+
+    std::printf("%zu triangles, %d random rays, %d camera rays in packets of %d, Mrays/s\n",
+                mesh.faces.size(), random.size(), camera.size(), RAY_PACKET_SIZE);
+    std::printf("%-6s %9s %7s %10s %8s %8s %8s %8s\n", "width", "build ms", "nodes", "bytes", "closest", "any", "single", "packets");
+
+    for (int width : {2, 4, 8}) {
+        BVHBuildOptions options;
+        options.width = width;
+        auto start = std::chrono::steady_clock::now();
+        BVH bvh(mesh, options);
+        double buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        int hits = 0;
+        double closestTime = bestTime([&]() {
+            hits = 0;
+            for (int i = 0; i < random.size(); i++) {
+                float t;
+                hits += bvh.closestTriangle(random.ray(i), t) >= 0;
+            }
+        });
+
+        int occluded = 0;
+        double anyTime = bestTime([&]() {
+            occluded = 0;
+            for (int i = 0; i < random.size(); i++) {
+                float t;
+                occluded += bvh.anyTriangle(random.ray(i), t) >= 0;
+            }
+        });
+
+        int singleHits = 0;
+        double singleTime = bestTime([&]() {
+            singleHits = 0;
+            for (int i = 0; i < camera.size(); i++) {
+                Ray ray = camera.ray(i);
+                float t;
+                singleHits += bvh.closestHit(ray, t, [&](int face, float) {
+                    return intersectTriangle(mesh, face, ray);
+                }) >= 0;
+            }
+        });
+
+        int packetHits = 0;
+        double packetTime = bestTime([&]() {
+            packetHits = 0;
+            RayPacket packet;
+            for (int first = 0; first < camera.size(); first += RAY_PACKET_SIZE) {
+                packet.size = std::min(RAY_PACKET_SIZE, camera.size() - first);
+                for (int r = 0; r < packet.size; r++) {
+                    packet.rays[r] = camera.ray(first + r);
+                }
+                float t[RAY_PACKET_SIZE];
+                int closest[RAY_PACKET_SIZE];
+                bvh.closestHitPacket(packet, t, closest, [&](int r, int face, float) {
+                    return intersectTriangle(mesh, face, packet.rays[r]);
+                });
+                for (int r = 0; r < packet.size; r++) {
+                    packetHits += closest[r] >= 0;
+                }
+            }
+        });
+
+        std::printf("%-6d %9.1f %7zu %10zu %8.2f %8.2f %8.2f %8.2f\n", width, buildTime, bvh.nodeCount(), bvh.memoryUsage(),
+                    random.size() / closestTime / 1e6, random.size() / anyTime / 1e6,
+                    camera.size() / singleTime / 1e6, camera.size() / packetTime / 1e6);
+        if (singleHits != packetHits) {
+            std::printf("       packets hit %d camera rays, single rays %d\n", packetHits, singleHits);
+        }
+    }
+}
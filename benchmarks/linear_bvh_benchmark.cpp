@@ -0,0 +1,63 @@
+#include "benchmark.h"
+
+#include <cstdio>
+#include "acceleration/BVH.h"
+
+// Traversal of the flattened binary BVH (LinearBVHNode array) over the bunny
+// Note: The traversal-only run intersects no primitives, so every ray visits all nodes its box tests reach and the
+//       rate is that of the node array walk alone. The closest-hit runs add the scalar triangle test per primitive
+//       (closestHit) or the SIMD test of whole leaves (closestTriangle).
+void benchmarkLinearBVH() {
+    const Mesh& mesh = bunnyMesh();
+    const RaySet rays = randomRays(meshBounds(mesh), 400000, 7);
+
+    std::printf("%zu triangles, %d random rays, binary BVH, Mrays/s\n", mesh.faces.size(), rays.size());
+    std::printf("%-7s %7s %10s %10s %11s %8s %8s %7s\n", "split", "nodes", "bytes", "traversal", "tests/ray", "closest", "SIMD", "hits");
+
+    for (BVHSplitMethod splitMethod : {BVHSplitMethod::SAH, BVHSplitMethod::Median}) {
+        BVHBuildOptions options;
+        options.splitMethod = splitMethod;
+        options.width = 2;
+        BVH bvh(mesh, options);
+
+        long tests = 0;
+        double traversalTime = bestTime([&]() {
+            tests = 0;
+            for (int i = 0; i < rays.size(); i++) {
+                float t;
+                bvh.closestHit(rays.ray(i), t, [&](int, float) {
+                    tests++;
+                    return -1.0f;
+                });
+            }
+        });
+
+        int hits = 0;
+        double closestTime = bestTime([&]() {
+            hits = 0;
+            for (int i = 0; i < rays.size(); i++) {
+                Ray ray = rays.ray(i);
+                float t;
+                hits += bvh.closestHit(ray, t, [&](int face, float) {
+                    return intersectTriangle(mesh, face, ray);
+                }) >= 0;
+            }
+        });
+
+        int simdHits = 0;
+        double simdTime = bestTime([&]() {
+            simdHits = 0;
+            for (int i = 0; i < rays.size(); i++) {
+                float t;
+                simdHits += bvh.closestTriangle(rays.ray(i), t) >= 0;
+            }
+        });
+
+        std::printf("%-7s %7zu %10zu %10.2f %11.1f %8.2f %8.2f %7d\n", splitMethod == BVHSplitMethod::SAH ? "SAH" : "median",
+                    bvh.nodeCount(), bvh.memoryUsage(), rays.size() / traversalTime / 1e6,
+                    static_cast<double>(tests) / rays.size(), rays.size() / closestTime / 1e6, rays.size() / simdTime / 1e6, hits);
+        if (simdHits != hits) {
+            std::printf("        the SIMD leaf test hit %d rays\n", simdHits);
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#include "benchmark.h"
+
+#include <cstdio>
+#include <random>
+#include "primitive/primitivefunction.h"
+
+// Intersection of random object-space rays with the unit primitives, including the normal of the hit
+void benchmarkPrimitives() {
+    const int RAY_COUNT = 2000000;
+
+    // Rays from outside through random points around the primitive, most of them hit
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> uniform(-1, 1);
+    std::vector<glm::vec4> origins(RAY_COUNT);
+    std::vector<glm::vec4> directions(RAY_COUNT);
+    for (int i = 0; i < RAY_COUNT; i++) {
+        glm::vec3 direction = glm::normalize(glm::vec3(uniform(rng), uniform(rng), uniform(rng)));
+        glm::vec3 target = 0.6f * glm::vec3(uniform(rng), uniform(rng), uniform(rng));
+        origins[i] = glm::vec4(target - 3.0f * direction, 1);
+        directions[i] = glm::vec4(direction, 0);
+    }
+
+    PrimitiveFunction primitives;
+    auto run = [&](const char* name, auto intersect) {
+        int hits = 0;
+        float sum = 0;
+        double time = bestTime([&]() {
+            hits = 0;
+            sum = 0;
+            for (int i = 0; i < RAY_COUNT; i++) {
+                glm::vec4 hit = intersect(origins[i], directions[i]);
+                if (hit.w > 0) {
+                    hits++;
+                    sum += hit.w + hit.x;
+                }
+            }
+        });
+        std::printf("%-9s %8.2f %7.1f%% %12.1f\n", name, RAY_COUNT / time / 1e6, 100.0 * hits / RAY_COUNT, sum);
+    };
+
+    // Each intersector returns the normal of the hit and its distance in w
+    std::printf("%d rays per primitive, Mrays/s\n", RAY_COUNT);
+    std::printf("%-9s %8s %8s %12s\n", "shape", "rays/s", "hits", "checksum");
+    run("cube", [&](const glm::vec4& p, const glm::vec4& d) {
+        PrimitiveHit hit = primitives.cubeIntersect(p, d);
+        return hit.t > 0 ? glm::vec4(primitives.cubeNormal(hit.surface), hit.t) : glm::vec4(0);
+    });
+    run("sphere", [&](const glm::vec4& p, const glm::vec4& d) {
+        PrimitiveHit hit = primitives.sphereIntersect(p, d);
+        return hit.t > 0 ? glm::vec4(primitives.sphereNormal(p, d, hit.t), hit.t) : glm::vec4(0);
+    });
+    run("cylinder", [&](const glm::vec4& p, const glm::vec4& d) {
+        PrimitiveHit hit = primitives.cylinderIntersect(p, d);
+        return hit.t > 0 ? glm::vec4(primitives.cylinderNormal(p, d, hit), hit.t) : glm::vec4(0);
+    });
+    run("cone", [&](const glm::vec4& p, const glm::vec4& d) {
+        PrimitiveHit hit = primitives.coneIntersect(p, d);
+        return hit.t > 0 ? glm::vec4(primitives.coneNormal(p, d, hit), hit.t) : glm::vec4(0);
+    });
+}
@@ -16,3 +16,14 @@ void AABB::extend(const AABB& box) {
     maxBounds = glm::max(maxBounds, box.maxBounds);
 }
 
+float AABB::surfaceArea() const {
+    glm::vec3 dimensions = maxBounds - minBounds;
+    if (dimensions.x < 0 || dimensions.y < 0 || dimensions.z < 0) {
+        return 0.0f;
+    }
+    return 2.0f * (dimensions.x * dimensions.y + dimensions.y * dimensions.z + dimensions.z * dimensions.x);
+}
+
+glm::vec3 AABB::centroid() const {
+    return (minBounds + maxBounds) * 0.5f;
+}
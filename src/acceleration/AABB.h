@@ -17,4 +17,10 @@ struct AABB {
 
     // Extend the bounding box to include another bounding box
     void extend(const AABB& box);
+
+    // Surface area of the bounding box, 0 for an empty box
+    float surfaceArea() const;
+
+    // Center point of the bounding box
+    glm::vec3 centroid() const;
 };
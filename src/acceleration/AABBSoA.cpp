@@ -0,0 +1,154 @@
+#include "AABBSoA.h"
+#include <algorithm>
+#include <cfloat>
+
+/******************************** Scalar kernel ********************************/
+// Note: These match the SIMD min/max instructions, which return the second operand if either one is NaN.
+//       Together with the operand order below this keeps the scalar results identical to the SIMD ones.
+static inline float minLane(float a, float b) {
+    return a < b ? a : b;
+}
+
+static inline float maxLane(float a, float b) {
+    return a > b ? a : b;
+}
+
+// Slab test of one box given its planes along each axis in the order in which the ray crosses them
+// Note: Every NaN distance is the first operand of minLane/maxLane and the second operand is never NaN, so NaN
+//       distances are skipped. This is the same order of operations as in the SIMD kernels.
+static inline bool intersectSlabs(float nearX, float nearY, float nearZ, float farX, float farY, float farZ,
+                                  const glm::vec3& origin, const glm::vec3& invD, float tMax, float& tEntry) {
+    float tNear = maxLane((nearX - origin.x) * invD.x, maxLane((nearY - origin.y) * invD.y, maxLane((nearZ - origin.z) * invD.z, 0.0f)));
+    float tFar = minLane((farX - origin.x) * invD.x, minLane((farY - origin.y) * invD.y, minLane((farZ - origin.z) * invD.z, INFINITY)));
+    tFar = minLane(tFar * SLAB_FAR_SCALE, tMax);
+
+    tEntry = tNear;
+    return tNear <= tFar;
+}
+
+template <int N>
+static int intersectScalar(const AABBSoA<N>& boxes, int first, int count, const Ray& ray, float tMax, float* tEntry) {
+    // The planes that are crossed first along each axis
+    const float* nearX = ray.sign[0] ? boxes.maxX : boxes.minX;
+    const float* nearY = ray.sign[1] ? boxes.maxY : boxes.minY;
+    const float* nearZ = ray.sign[2] ? boxes.maxZ : boxes.minZ;
+    const float* farX = ray.sign[0] ? boxes.minX : boxes.maxX;
+    const float* farY = ray.sign[1] ? boxes.minY : boxes.maxY;
+    const float* farZ = ray.sign[2] ? boxes.minZ : boxes.maxZ;
+    glm::vec3 origin(ray.origin);
+
+    int mask = 0;
+    for (int i = first; i < first + count; i++) {
+        if (intersectSlabs(nearX[i], nearY[i], nearZ[i], farX[i], farY[i], farZ[i], origin, ray.invDirection, tMax, tEntry[i])) {
+            mask |= 1 << i;
+        }
+    }
+    return mask;
+}
+
+/******************************** SIMD kernels ********************************/
+#ifdef SIMD_X86
+// Test 4 boxes starting at lane first
+template <int N>
+TARGET_SSE42 static int intersectSSE(const AABBSoA<N>& boxes, int first, const Ray& ray, float tMax, float* tEntry) {
+    __m128 ox = _mm_set1_ps(ray.origin.x);
+    __m128 oy = _mm_set1_ps(ray.origin.y);
+    __m128 oz = _mm_set1_ps(ray.origin.z);
+    __m128 ix = _mm_set1_ps(ray.invDirection.x);
+    __m128 iy = _mm_set1_ps(ray.invDirection.y);
+    __m128 iz = _mm_set1_ps(ray.invDirection.z);
+
+    // The planes that are crossed first along each axis
+    const float* nearX = ray.sign[0] ? boxes.maxX : boxes.minX;
+    const float* nearY = ray.sign[1] ? boxes.maxY : boxes.minY;
+    const float* nearZ = ray.sign[2] ? boxes.maxZ : boxes.minZ;
+    const float* farX = ray.sign[0] ? boxes.minX : boxes.maxX;
+    const float* farY = ray.sign[1] ? boxes.minY : boxes.maxY;
+    const float* farZ = ray.sign[2] ? boxes.minZ : boxes.maxZ;
+
+    __m128 txNear = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearX + first), ox), ix);
+    __m128 tyNear = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearY + first), oy), iy);
+    __m128 tzNear = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearZ + first), oz), iz);
+    __m128 txFar = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farX + first), ox), ix);
+    __m128 tyFar = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farY + first), oy), iy);
+    __m128 tzFar = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farZ + first), oz), iz);
+
+    // Note: minps/maxps return the second operand if either one is NaN, so NaN distances are passed first
+    __m128 tNear = _mm_max_ps(txNear, _mm_max_ps(tyNear, _mm_max_ps(tzNear, _mm_setzero_ps())));
+    __m128 tFar = _mm_min_ps(txFar, _mm_min_ps(tyFar, _mm_min_ps(tzFar, _mm_set1_ps(INFINITY))));
+    tFar = _mm_min_ps(_mm_mul_ps(tFar, _mm_set1_ps(SLAB_FAR_SCALE)), _mm_set1_ps(tMax));
+
+    _mm_storeu_ps(tEntry + first, tNear);
+    return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar)) << first;
+}
+
+TARGET_AVX2 static int intersectAVX2(const AABB8& boxes, const Ray& ray, float tMax, float* tEntry) {
+    __m256 ox = _mm256_set1_ps(ray.origin.x);
+    __m256 oy = _mm256_set1_ps(ray.origin.y);
+    __m256 oz = _mm256_set1_ps(ray.origin.z);
+    __m256 ix = _mm256_set1_ps(ray.invDirection.x);
+    __m256 iy = _mm256_set1_ps(ray.invDirection.y);
+    __m256 iz = _mm256_set1_ps(ray.invDirection.z);
+
+    const float* nearX = ray.sign[0] ? boxes.maxX : boxes.minX;
+    const float* nearY = ray.sign[1] ? boxes.maxY : boxes.minY;
+    const float* nearZ = ray.sign[2] ? boxes.maxZ : boxes.minZ;
+    const float* farX = ray.sign[0] ? boxes.minX : boxes.maxX;
+    const float* farY = ray.sign[1] ? boxes.minY : boxes.maxY;
+    const float* farZ = ray.sign[2] ? boxes.minZ : boxes.maxZ;
+
+    __m256 txNear = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(nearX), ox), ix);
+    __m256 tyNear = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(nearY), oy), iy);
+    __m256 tzNear = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(nearZ), oz), iz);
+    __m256 txFar = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(farX), ox), ix);
+    __m256 tyFar = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(farY), oy), iy);
+    __m256 tzFar = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(farZ), oz), iz);
+
+    __m256 tNear = _mm256_max_ps(txNear, _mm256_max_ps(tyNear, _mm256_max_ps(tzNear, _mm256_setzero_ps())));
+    __m256 tFar = _mm256_min_ps(txFar, _mm256_min_ps(tyFar, _mm256_min_ps(tzFar, _mm256_set1_ps(INFINITY))));
+    tFar = _mm256_min_ps(_mm256_mul_ps(tFar, _mm256_set1_ps(SLAB_FAR_SCALE)), _mm256_set1_ps(tMax));
+
+    _mm256_storeu_ps(tEntry, tNear);
+    return _mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+}
+#endif
+
+/******************************** Dispatch ********************************/
+// Note: tMax is clamped so that the boxes at infinity of unused lanes are not hit by unbounded rays
+int intersectAABB4(SIMDLevel level, const AABB4& boxes, const Ray& ray, float tMax, float tEntry[4]) {
+    tMax = std::min(tMax, FLT_MAX);
+#ifdef SIMD_X86
+    if (level != SIMDLevel::Scalar) {
+        return intersectSSE(boxes, 0, ray, tMax, tEntry);
+    }
+#endif
+    return intersectScalar(boxes, 0, 4, ray, tMax, tEntry);
+}
+
+int intersectAABB8(SIMDLevel level, const AABB8& boxes, const Ray& ray, float tMax, float tEntry[8]) {
+    tMax = std::min(tMax, FLT_MAX);
+#ifdef SIMD_X86
+    if (level == SIMDLevel::AVX2) {
+        return intersectAVX2(boxes, ray, tMax, tEntry);
+    }
+    if (level == SIMDLevel::SSE42) {
+        return intersectSSE(boxes, 0, ray, tMax, tEntry) | intersectSSE(boxes, 4, ray, tMax, tEntry);
+    }
+#endif
+    return intersectScalar(boxes, 0, 8, ray, tMax, tEntry);
+}
+
+int intersectAABB4(const AABB4& boxes, const Ray& ray, float tMax, float tEntry[4]) {
+    return intersectAABB4(activeSIMDLevel(), boxes, ray, tMax, tEntry);
+}
+
+int intersectAABB8(const AABB8& boxes, const Ray& ray, float tMax, float tEntry[8]) {
+    return intersectAABB8(activeSIMDLevel(), boxes, ray, tMax, tEntry);
+}
+
+bool intersectAABB(const AABB& box, const Ray& ray, float tMax, float& tEntry) {
+    const glm::vec3 bounds[2] = {box.minBounds, box.maxBounds};
+    return intersectSlabs(bounds[ray.sign[0]].x, bounds[ray.sign[1]].y, bounds[ray.sign[2]].z,
+                          bounds[1 - ray.sign[0]].x, bounds[1 - ray.sign[1]].y, bounds[1 - ray.sign[2]].z,
+                          glm::vec3(ray.origin), ray.invDirection, std::min(tMax, FLT_MAX), tEntry);
+}
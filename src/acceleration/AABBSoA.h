@@ -0,0 +1,71 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cmath>
+#include "AABB.h"
+#include "SIMD.h"
+#include "utils/ray.h"
+
+// Scale of the far distance of a box in the slab tests, 1 + 2 * gamma(3) with gamma(n) = n * u / (1 - n * u)
+// Note: The distance to a plane is computed with 2 rounded operations, so the scaled far distance is never below the
+//       exact one and boxes that are only touched by a ray are not culled because of rounding.
+static const float SLAB_FAR_SCALE = 1.0f + 2.0f * (3.0f * 0x1p-24f) / (1.0f - 3.0f * 0x1p-24f);
+
+// Bounds of up to N boxes in structure-of-arrays layout, so that one ray can be tested against all of them with SIMD instructions
+// Note: Unused lanes hold a degenerate box at infinity which is never hit.
+template <int N>
+struct alignas(32) AABBSoA {
+    float minX[N], minY[N], minZ[N];
+    float maxX[N], maxY[N], maxZ[N];
+
+    AABBSoA() {
+        for (int i = 0; i < N; i++) {
+            minX[i] = minY[i] = minZ[i] = INFINITY;
+            maxX[i] = maxY[i] = maxZ[i] = INFINITY;
+        }
+    }
+
+    AABB get(int lane) const {
+        AABB box;
+        box.minBounds = glm::vec3(minX[lane], minY[lane], minZ[lane]);
+        box.maxBounds = glm::vec3(maxX[lane], maxY[lane], maxZ[lane]);
+        return box;
+    }
+
+    void set(int lane, const AABB& box) {
+        minX[lane] = box.minBounds.x;
+        minY[lane] = box.minBounds.y;
+        minZ[lane] = box.minBounds.z;
+        maxX[lane] = box.maxBounds.x;
+        maxY[lane] = box.maxBounds.y;
+        maxZ[lane] = box.maxBounds.z;
+    }
+};
+
+using AABB4 = AABBSoA<4>;
+using AABB8 = AABBSoA<8>;
+
+// Test a ray against all boxes within [0, tMax] and return a bit mask of the boxes that are hit
+// @param tEntry  On return the distance at which the ray enters each box (only meaningful for boxes that are hit).
+// Note: The near and far plane of each axis are selected with the precomputed signs of the ray direction. A ray that is
+//       parallel to an axis and starts on a plane of the box gives 0 * inf = NaN there, such distances are ignored, so
+//       the ray counts as inside that slab. Together with SLAB_FAR_SCALE, no box that the ray touches is culled.
+//       The SIMD kernel is selected at runtime, all kernels (including the scalar fallback) give identical results.
+int intersectAABB4(const AABB4& boxes, const Ray& ray, float tMax, float tEntry[4]);
+int intersectAABB8(const AABB8& boxes, const Ray& ray, float tMax, float tEntry[8]);
+
+// Kernels for a given instruction set, the level must be supported by the CPU
+int intersectAABB4(SIMDLevel level, const AABB4& boxes, const Ray& ray, float tMax, float tEntry[4]);
+int intersectAABB8(SIMDLevel level, const AABB8& boxes, const Ray& ray, float tMax, float tEntry[8]);
+
+// Overloads for code that is templated on the width
+inline int intersectAABB(const AABB4& boxes, const Ray& ray, float tMax, float tEntry[4]) {
+    return intersectAABB4(boxes, ray, tMax, tEntry);
+}
+
+inline int intersectAABB(const AABB8& boxes, const Ray& ray, float tMax, float tEntry[8]) {
+    return intersectAABB8(boxes, ray, tMax, tEntry);
+}
+
+// Same test for a single box, gives the same result as the lane of the box in intersectAABB4/8
+bool intersectAABB(const AABB& box, const Ray& ray, float tMax, float& tEntry);
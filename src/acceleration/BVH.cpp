@@ -1,93 +1,115 @@
 #include "BVH.h"
 #include "primitive/mesh.h"
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 
 // Construct BVH class
-BVH::BVH(const std::vector<RenderShapeData>& shapes) : originalShapes(shapes) {
-    std::vector<int> indices(originalShapes.size()); //  Create a indices list of shapes for tracking and comparison
-    std::iota(indices.begin(), indices.end(), 0);  // initialize indices
-    root = build(indices); // Build the tree
+BVH::BVH(const std::vector<RenderShapeData>& shapes, const BVHBuildOptions& options) :
+    options(options)
+{
+    // Precompute the bounds and centroid of each shape once
+    std::vector<BVHPrimitive> primitives(shapes.size());
+    for (int i = 0; i < static_cast<int>(shapes.size()); i++) {
+        primitives[i].bounds = computeAABBForShape(shapes[i]);
+        primitives[i].centroid = primitives[i].bounds.centroid();
+        primitives[i].index = i;
+    }
+    buildTree(primitives);
 }
 
-BVH::BVH(const Mesh& mesh) {
-    std::vector<int> indices(mesh.faces.size()); // Indices list of triangles for tracking
-    std::iota(indices.begin(), indices.end(), 0);  // initialize indices
-    root = buildForMesh(mesh, indices); // Build the tree for the mesh
+BVH::BVH(const Mesh& mesh, const BVHBuildOptions& options) :
+    options(options)
+{
+    // Precompute the bounds and centroid of each triangle once
+    std::vector<BVHPrimitive> primitives(mesh.faces.size());
+    for (int i = 0; i < static_cast<int>(mesh.faces.size()); i++) {
+        primitives[i].bounds = computeAABBForTriangle(mesh, i);
+        primitives[i].centroid = primitives[i].bounds.centroid();
+        primitives[i].index = i;
+    }
+    // Note: The SIMD triangle test intersects up to 8 triangles of a leaf at once, which the SAH takes into account
+    leafGroupSize = TRIANGLE_SIMD_WIDTH;
+    buildTree(primitives);
+
+    // Store the triangles in the order of the leaves for the SIMD triangle test
+    triangles = TriangleSoA(mesh, primitiveIndices);
 }
 
 // Destroyer of BVH class
-BVH::~BVH() {
-    deleteNode(root);
-}
+BVH::~BVH() {}
 
 /******************************** Functions to build BVH ********************************/
-// Build the BVH recursively
-BVHNode* BVH::build(std::vector<int>& indices) {
-    // Base case: If only one shape, create a leaf node.
-    if (indices.size() == 1) {
-        BVHNode* leaf = new BVHNode();
-        leaf->shapeIndex = indices[0];
-        leaf->bounds = computeAABBForShape(originalShapes[indices[0]]);
-        return leaf;
+// Number of bins along an axis evaluated by the SAH builder
+static const int SAH_BIN_COUNT = 12;
+
+// Below this depth the SAH builder falls back to median splits, which keeps the tree depth within the traversal stack
+static const int SAH_MAX_DEPTH = 32;
+
+// Cost of visiting a node relative to intersecting a primitive group, used to decide between splitting and making a leaf
+// Note: With SIMD box and triangle tests, visiting a node costs about as much as testing a group of triangles
+static const float SAH_TRAVERSAL_COST = 1.0f;
+
+// Build the pointer tree, then flatten or collapse it into the node list for traversal
+void BVH::buildTree(std::vector<BVHPrimitive>& primitives) {
+    options.maxLeafSize = std::clamp(options.maxLeafSize, 1, 255);
+    leafGroupSize = std::min(leafGroupSize, options.maxLeafSize);
+    if (options.width != 4 && options.width != 8) {
+        options.width = 2;
+    }
+    if (primitives.empty()) {
+        return;
     }
 
-    // Compute the bounding box for all shapes within the indices
-    AABB combinedBox;
-    for (int index : indices) {
-        combinedBox.extend(computeAABBForShape(originalShapes[index]));
+    BVHNode* root = build(primitives, 0, static_cast<int>(primitives.size()), 0);
+
+    // Note: The builder reorders the primitives so that every leaf refers to a contiguous range
+    primitiveIndices.resize(primitives.size());
+    for (size_t i = 0; i < primitives.size(); i++) {
+        primitiveIndices[i] = primitives[i].index;
     }
 
-    // Decide which axix to be cut off
-    // Note: Cut off along the longest axis of the bounding box
-    glm::vec3 dimensions = combinedBox.maxBounds - combinedBox.minBounds;
-    int axis;
-    if (dimensions.x >= dimensions.y && dimensions.x >= dimensions.z) {
-        axis = 0;  // x-axis
-    } else if (dimensions.y >= dimensions.x && dimensions.y >= dimensions.z) {
-        axis = 1;  // y-axis
+    if (options.width == 4) {
+        collapse(root, nodes4);
+    } else if (options.width == 8) {
+        collapse(root, nodes8);
     } else {
-        axis = 2;  // z-axis
+        flatten(root);
     }
+    deleteNode(root);
+}
 
-    // Sort indices based on their centroid in the chosen axis
-    // Note: This is a lambda expression which defines a customed operator to utilize std::sort
-    std::sort(indices.begin(), indices.end(), [this, axis](int a, int b) {
-        glm::vec3 centroidA = (computeAABBForShape(originalShapes[a]).minBounds + computeAABBForShape(originalShapes[a]).maxBounds) * 0.5f;
-        glm::vec3 centroidB = (computeAABBForShape(originalShapes[b]).minBounds + computeAABBForShape(originalShapes[b]).maxBounds) * 0.5f;
-        return centroidA[axis] < centroidB[axis];
-    });
-
-    // Divide the indices to left and right
-    size_t midPoint = indices.size() / 2;
-    std::vector<int> leftIndices(indices.begin(), indices.begin() + midPoint);
-    std::vector<int> rightIndices(indices.begin() + midPoint, indices.end());
-
-    // Create an intermediate node, assign the combined BBox and do the recursion
+// Build the BVH recursively over the primitives in [start, end)
+BVHNode* BVH::build(std::vector<BVHPrimitive>& primitives, int start, int end, int depth) {
     BVHNode* node = new BVHNode();
-    node->bounds = combinedBox;
-    node->left = build(leftIndices);
-    node->right = build(rightIndices);
 
-    return node;
-}
+    // Compute the bounding box for all primitives and their centroids within the range
+    AABB centroidBounds;
+    for (int i = start; i < end; i++) {
+        node->bounds.extend(primitives[i].bounds);
+        centroidBounds.extend(primitives[i].centroid);
+    }
 
-BVHNode* BVH::buildForMesh(const Mesh& mesh, std::vector<int>& indices) {
-    // Base case: If only one triangle, create a leaf node.
-    if (indices.size() == 1) {
-        BVHNode* leaf = new BVHNode();
-        leaf->triangleIndex = indices[0];  // set triangleIndex instead of shapeIndex
-        leaf->bounds = computeAABBForTriangle(mesh, indices[0]);
-        return leaf;
+    // Find the cheapest split with SAH
+    int count = end - start;
+    bool useSAH = options.splitMethod == BVHSplitMethod::SAH && depth < SAH_MAX_DEPTH;
+    SAHSplit split;
+    if (useSAH && count > 1) {
+        split = findSAHSplit(primitives, start, end, node->bounds, centroidBounds);
     }
 
-    // Compute the bounding box for all triangles within the indices
-    AABB combinedBox;
-    for (int index : indices) {
-        combinedBox.extend(computeAABBForTriangle(mesh, index));
+    // Base case: If few enough primitives, create a leaf node.
+    // Note: With SAH, a node that could be a leaf is still split if that is expected to be cheaper than intersecting
+    //       all of its primitives, so the leaf size adapts to the primitives up to maxLeafSize.
+    if (count <= options.maxLeafSize && !(useSAH && split.cost < groupCount(count))) {
+        node->primitivesOffset = start;
+        node->primitiveCount = count;
+        return node;
     }
 
     // Decide which axis to be cut off
-    glm::vec3 dimensions = combinedBox.maxBounds - combinedBox.minBounds;
+    // Note: Cut off along the longest axis of the bounding box
+    glm::vec3 dimensions = node->bounds.maxBounds - node->bounds.minBounds;
     int axis;
     if (dimensions.x >= dimensions.y && dimensions.x >= dimensions.z) {
         axis = 0;  // x-axis
@@ -97,29 +119,115 @@ BVHNode* BVH::buildForMesh(const Mesh& mesh, std::vector<int>& indices) {
         axis = 2;  // z-axis
     }
 
-    // Sort indices based on the triangle centroid in the chosen axis
-    std::sort(indices.begin(), indices.end(), [&mesh, axis, this](int a, int b) {
-        AABB aabbA = computeAABBForTriangle(mesh, a);
-        AABB aabbB = computeAABBForTriangle(mesh, b);
+    // Divide the primitives to left and right
+    int mid = -1;
+    if (split.axis >= 0) {
+        axis = split.axis;
+        mid = partitionSAH(primitives, start, end, centroidBounds, split);
+    }
+    if (mid <= start || mid >= end) {
+        mid = partitionMedian(primitives, start, end, axis);
+    }
+
+    // Create an intermediate node and do the recursion
+    node->splitAxis = axis;
+    node->left = build(primitives, start, mid, depth + 1);
+    node->right = build(primitives, mid, end, depth + 1);
 
-        glm::vec3 centroidA = (aabbA.minBounds + aabbA.maxBounds) * 0.5f;
-        glm::vec3 centroidB = (aabbB.minBounds + aabbB.maxBounds) * 0.5f;
+    return node;
+}
 
-        return centroidA[axis] < centroidB[axis];
+// Divide the primitives at the median of their centroids along the axis and return the split position
+// Note: nth_element only partially sorts the range, which keeps the build in O(n log n)
+int BVH::partitionMedian(std::vector<BVHPrimitive>& primitives, int start, int end, int axis) {
+    int mid = start + (end - start) / 2;
+    std::nth_element(primitives.begin() + start, primitives.begin() + mid, primitives.begin() + end,
+                     [axis](const BVHPrimitive& a, const BVHPrimitive& b) {
+        return a.centroid[axis] < b.centroid[axis];
     });
+    return mid;
+}
 
-    // Divide the indices to left and right
-    size_t midPoint = indices.size() / 2;
-    std::vector<int> leftIndices(indices.begin(), indices.begin() + midPoint);
-    std::vector<int> rightIndices(indices.begin() + midPoint, indices.end());
+// Find the cheapest split of the primitives with the binned surface area heuristic
+// Note: Centroids are sorted into bins along each axis, and the boundary between bins with the lowest
+//       cost (surface area times primitive group count of both sides) is chosen. The cost is relative to the surface
+//       area of the node and to the cost of intersecting a primitive, so it can be compared to the primitive count.
+BVH::SAHSplit BVH::findSAHSplit(const std::vector<BVHPrimitive>& primitives, int start, int end, const AABB& bounds, const AABB& centroidBounds) const {
+    struct Bin {
+        AABB bounds;
+        int count = 0;
+    };
+
+    SAHSplit best;
+    float area = bounds.surfaceArea();
+    if (!(area > 0)) {
+        return best;
+    }
 
-    // Create an intermediate node, assign the combined BBox and do the recursion
-    BVHNode* node = new BVHNode();
-    node->bounds = combinedBox;
-    node->left = buildForMesh(mesh, leftIndices);
-    node->right = buildForMesh(mesh, rightIndices);
+    for (int currentAxis = 0; currentAxis < 3; currentAxis++) {
+        float minCentroid = centroidBounds.minBounds[currentAxis];
+        float extent = centroidBounds.maxBounds[currentAxis] - minCentroid;
+        if (!(extent > 0)) {
+            continue;
+        }
 
-    return node;
+        // Sort the centroids into bins
+        Bin bins[SAH_BIN_COUNT];
+        for (int i = start; i < end; i++) {
+            int b = std::min(static_cast<int>(SAH_BIN_COUNT * (primitives[i].centroid[currentAxis] - minCentroid) / extent), SAH_BIN_COUNT - 1);
+            bins[b].count++;
+            bins[b].bounds.extend(primitives[i].bounds);
+        }
+
+        // Sweep from the left to get the area and count on the left of each boundary
+        float leftArea[SAH_BIN_COUNT - 1];
+        int leftCount[SAH_BIN_COUNT - 1];
+        AABB leftBox;
+        int leftSum = 0;
+        for (int b = 0; b < SAH_BIN_COUNT - 1; b++) {
+            leftBox.extend(bins[b].bounds);
+            leftSum += bins[b].count;
+            leftArea[b] = leftBox.surfaceArea();
+            leftCount[b] = leftSum;
+        }
+
+        // Sweep from the right and evaluate the cost of each boundary
+        AABB rightBox;
+        int rightSum = 0;
+        for (int b = SAH_BIN_COUNT - 1; b > 0; b--) {
+            rightBox.extend(bins[b].bounds);
+            rightSum += bins[b].count;
+            if (leftCount[b - 1] == 0 || rightSum == 0) {
+                continue;
+            }
+            float cost = groupCount(leftCount[b - 1]) * leftArea[b - 1] + groupCount(rightSum) * rightBox.surfaceArea();
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = currentAxis;
+                best.bin = b - 1;
+            }
+        }
+    }
+
+    best.cost = SAH_TRAVERSAL_COST + best.cost / area;
+    return best;
+}
+
+// Number of primitive groups that are intersected together in a leaf of the given size
+int BVH::groupCount(int primitiveCount) const {
+    return (primitiveCount + leafGroupSize - 1) / leafGroupSize;
+}
+
+// Move the primitives in the bins up to the boundary of the split to the left and return the split position
+int BVH::partitionSAH(std::vector<BVHPrimitive>& primitives, int start, int end, const AABB& centroidBounds, const SAHSplit& split) {
+    int axis = split.axis;
+    float minCentroid = centroidBounds.minBounds[axis];
+    float extent = centroidBounds.maxBounds[axis] - minCentroid;
+    auto midIter = std::partition(primitives.begin() + start, primitives.begin() + end, [&](const BVHPrimitive& primitive) {
+        int b = std::min(static_cast<int>(SAH_BIN_COUNT * (primitive.centroid[axis] - minCentroid) / extent), SAH_BIN_COUNT - 1);
+        return b <= split.bin;
+    });
+    return static_cast<int>(midIter - primitives.begin());
 }
 
 
@@ -129,12 +237,15 @@ AABB BVH::computeAABBForShape(const RenderShapeData& shape) {
 
     // Set the local AABB based on the primitive type
     // Note: non-mesh primitives are all bounded in [-0.5, 0.5]
-    if (shape.primitive.type == PrimitiveType::PRIMITIVE_MESH) {
-        // Load the mesh from caching to avoid repetitive loading)
-        Mesh mesh = MeshCache::getInstance().loadMeshWithCache(shape.primitive.meshfile);
+    if (shape.primitive.type == PrimitiveType::PRIMITIVE_MESH && shape.triangleBVH) {
+        // Use the root bounds of the shared triangle BVH instead of visiting every vertex of each instance
+        localAABB = shape.triangleBVH->bounds();
+    } else if (shape.primitive.type == PrimitiveType::PRIMITIVE_MESH) {
+        // Use the shared mesh handle (or load it from caching to avoid repetitive loading)
+        std::shared_ptr<const Mesh> mesh = shape.mesh ? shape.mesh : MeshCache::getInstance().loadMeshWithCache(shape.primitive.meshfile);
 
         // Compute AABB for the entire mesh
-        for (const auto& vertex : mesh.vertices) {
+        for (const auto& vertex : mesh->vertices) {
             localAABB.extend(vertex);
         }
     } else {
@@ -167,7 +278,7 @@ AABB BVH::computeAABBForShape(const RenderShapeData& shape) {
 AABB BVH::computeAABBForTriangle(const Mesh& mesh, int triangleIndex) {
     AABB triangleAABB;
 
-    Face triangle = mesh.faces[triangleIndex];
+    const Face &triangle = mesh.faces[triangleIndex];
 
     triangleAABB.extend(mesh.vertices[triangle.v[0]]);
     triangleAABB.extend(mesh.vertices[triangle.v[1]]);
@@ -176,78 +287,223 @@ AABB BVH::computeAABBForTriangle(const Mesh& mesh, int triangleIndex) {
     return triangleAABB;
 }
 
-/******************************** Functions to traverse BVH ********************************/
-// Get intersected nodes
-std::vector<RenderShapeData> BVH::potentialIntersections(const glm::vec4& cameraPos, const glm::vec4& d) const {
-    std::vector<RenderShapeData> potentialShapes;
-    potentialIntersectionsRecursive(root, cameraPos, d, potentialShapes);
-    return potentialShapes;
+// Flatten the pointer tree into the node list in depth-first order and return the index of the node
+int BVH::flatten(BVHNode* node) {
+    int nodeOffset = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+    nodes[nodeOffset].bounds = node->bounds;
+
+    if (node->primitiveCount > 0) {
+        nodes[nodeOffset].primitivesOffset = node->primitivesOffset;
+        nodes[nodeOffset].primitiveCount = static_cast<std::uint16_t>(node->primitiveCount);
+    } else {
+        // Note: The left child is placed right after its parent, only the right child offset is stored
+        nodes[nodeOffset].primitiveCount = 0;
+        nodes[nodeOffset].axis = static_cast<std::uint8_t>(node->splitAxis);
+        flatten(node->left);
+        int secondChildOffset = flatten(node->right);
+        nodes[nodeOffset].secondChildOffset = secondChildOffset;
+    }
+
+    return nodeOffset;
 }
 
-// Traverse in the BVH and add intersected nodes into potentialShapes
-void BVH::potentialIntersectionsRecursive(BVHNode* node, const glm::vec4& cameraPos, const glm::vec4& d, std::vector<RenderShapeData>& potentialShapes) const {
-    if (!node) {
-        return;
+// Collapse the pointer tree into an N-wide tree and return the index of the node
+// Note: Starting from the children of the binary node, the interior child with the largest surface area is
+//       repeatedly replaced by its two children until there are N children, so each wide node absorbs up to
+//       log2(N) levels of the binary tree.
+template <int N>
+int BVH::collapse(BVHNode* node, std::vector<WideBVHNode<N>>& wideNodes) {
+    BVHNode* children[N];
+    int numChildren = 0;
+    if (node->primitiveCount > 0) {
+        children[numChildren++] = node; // The root is a leaf
+    } else {
+        children[numChildren++] = node->left;
+        children[numChildren++] = node->right;
     }
 
-    if (intersects(node->bounds, cameraPos, d)) {
-        if (node->shapeIndex >= 0) {
-            potentialShapes.push_back(originalShapes[node->shapeIndex]);
+    while (numChildren < N) {
+        int largest = -1;
+        float largestArea = -1;
+        for (int i = 0; i < numChildren; i++) {
+            float area = children[i]->bounds.surfaceArea();
+            if (children[i]->primitiveCount == 0 && area > largestArea) {
+                largest = i;
+                largestArea = area;
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+        BVHNode* expanded = children[largest];
+        children[largest] = expanded->left;
+        children[numChildren++] = expanded->right;
+    }
+
+    // Note: Reserve the node before the recursion, the node list may be reallocated meanwhile so access it by index
+    int nodeOffset = static_cast<int>(wideNodes.size());
+    wideNodes.emplace_back();
+    wideNodes[nodeOffset].numChildren = numChildren;
+    for (int i = 0; i < numChildren; i++) {
+        int childOffset;
+        int childCount = children[i]->primitiveCount;
+        if (childCount > 0) {
+            childOffset = children[i]->primitivesOffset;
         } else {
-            potentialIntersectionsRecursive(node->left, cameraPos, d, potentialShapes);
-            potentialIntersectionsRecursive(node->right, cameraPos, d, potentialShapes);
+            childOffset = collapse(children[i], wideNodes);
         }
+        wideNodes[nodeOffset].childBounds.set(i, children[i]->bounds);
+        wideNodes[nodeOffset].childOffset[i] = childOffset;
+        wideNodes[nodeOffset].childCount[i] = static_cast<std::uint8_t>(childCount);
     }
-}
 
-// Get intersected triangle indices
-std::vector<int> BVH::potentialIntersectionsForMesh(const glm::vec4& cameraPos, const glm::vec4& d) const {
-    std::vector<int> potentialTriangles;
-    potentialIntersectionsRecursiveForMesh(root, cameraPos, d, potentialTriangles);
-    return potentialTriangles;
+    return nodeOffset;
 }
 
-// Traverse in the BVH and add intersected triangle indices into potentialTriangles
-void BVH::potentialIntersectionsRecursiveForMesh(BVHNode* node, const glm::vec4& cameraPos, const glm::vec4& d, std::vector<int>& potentialTriangles) const {
-    if (!node) {
-        return;
+AABB BVH::bounds() const {
+    AABB box;
+    if (!nodes.empty()) {
+        box = nodes[0].bounds;
     }
-
-    if (intersects(node->bounds, cameraPos, d)) {
-        if (node->triangleIndex >= 0) {
-            potentialTriangles.push_back(node->triangleIndex);
-        } else {
-            potentialIntersectionsRecursiveForMesh(node->left, cameraPos, d, potentialTriangles);
-            potentialIntersectionsRecursiveForMesh(node->right, cameraPos, d, potentialTriangles);
-        }
+    // Note: The root of a collapsed tree only stores the bounds of its children
+    for (int i = 0; !nodes4.empty() && i < nodes4[0].numChildren; i++) {
+        box.extend(nodes4[0].childBounds.get(i));
+    }
+    for (int i = 0; !nodes8.empty() && i < nodes8[0].numChildren; i++) {
+        box.extend(nodes8[0].childBounds.get(i));
     }
+    return box;
+}
+
+int BVH::width() const {
+    return options.width;
 }
 
+size_t BVH::nodeCount() const {
+    return nodes.size() + nodes4.size() + nodes8.size();
+}
+
+size_t BVH::memoryUsage() const {
+    return nodes.size() * sizeof(LinearBVHNode) + nodes4.size() * sizeof(WideBVHNode<4>) + nodes8.size() * sizeof(WideBVHNode<8>)
+         + primitiveIndices.size() * sizeof(int) + triangles.memoryUsage();
+}
+
+/******************************** Functions to traverse BVH ********************************/
 // Check whether a ray intersects AABB
 bool BVH::intersects(const AABB& box, const glm::vec4& cameraPos, const glm::vec4& d) const {
-    float tmin = (box.minBounds.x - cameraPos.x) / d.x;
-    float tmax = (box.maxBounds.x - cameraPos.x) / d.x;
-
-    if (tmin > tmax) std::swap(tmin, tmax);
+    return intersects(box, Ray(cameraPos, d), INFINITY);
+}
 
-    float tymin = (box.minBounds.y - cameraPos.y) / d.y;
-    float tymax = (box.maxBounds.y - cameraPos.y) / d.y;
+// Check whether a ray intersects AABB within [0, tMax] with the robust slab test
+bool BVH::intersects(const AABB& box, const Ray& ray, float tMax) const {
+    float tEntry;
+    return intersectAABB(box, ray, tMax, tEntry);
+}
 
-    if (tymin > tymax) std::swap(tymin, tymax);
+// Compute the bounds of the origins and reciprocal directions of the rays of a packet
+BVH::PacketInterval BVH::packetInterval(const RayPacket& packet) {
+    PacketInterval interval;
+    interval.originMin = interval.originMax = glm::vec3(packet.rays[0].origin);
+    interval.invDMin = interval.invDMax = packet.rays[0].invDirection;
+    for (int r = 1; r < packet.size; r++) {
+        interval.originMin = glm::min(interval.originMin, glm::vec3(packet.rays[r].origin));
+        interval.originMax = glm::max(interval.originMax, glm::vec3(packet.rays[r].origin));
+        interval.invDMin = glm::min(interval.invDMin, packet.rays[r].invDirection);
+        interval.invDMax = glm::max(interval.invDMax, packet.rays[r].invDirection);
+    }
 
-    if ((tmin > tymax) || (tymin > tmax)) return false;
+    // Note: An axis along which the directions change sign (or are parallel to the slabs) can not bound the packet
+    for (int axis = 0; axis < 3; axis++) {
+        interval.axisValid[axis] = std::isfinite(interval.invDMin[axis]) && std::isfinite(interval.invDMax[axis])
+                                && (interval.invDMin[axis] > 0 || interval.invDMax[axis] < 0);
+    }
+    return interval;
+}
 
-    if (tymin > tmin) tmin = tymin;
-    if (tymax < tmax) tmax = tymax;
+// Conservative slab test of a packet with interval arithmetic: returns false only if no ray of the packet hits the box within [0, tMax]
+// Note: For each axis, the nearest entry and the farthest exit over all rays are bounded using the extremes of the origins
+//       and reciprocal directions. If the latest entry is beyond the earliest exit, every ray misses the box.
+bool BVH::intersects(const AABB& box, const PacketInterval& interval, float tMax, float& tEntry) {
+    float tNear = 0;
+    float tFar = tMax;
+    for (int axis = 0; axis < 3; axis++) {
+        if (!interval.axisValid[axis]) {
+            continue;
+        }
+        float iMin = interval.invDMin[axis];
+        float iMax = interval.invDMax[axis];
+
+        // Rays with a positive direction enter at the min plane, rays with a negative direction at the max plane
+        float entryDistance, exitDistance;
+        if (iMin > 0) {
+            entryDistance = box.minBounds[axis] - interval.originMax[axis];
+            exitDistance = box.maxBounds[axis] - interval.originMin[axis];
+        } else {
+            entryDistance = box.maxBounds[axis] - interval.originMin[axis];
+            exitDistance = box.minBounds[axis] - interval.originMax[axis];
+        }
+        tNear = std::max(tNear, std::min(entryDistance * iMin, entryDistance * iMax));
+        tFar = std::min(tFar, std::max(exitDistance * iMin, exitDistance * iMax) * SLAB_FAR_SCALE);
+    }
 
-    float tzmin = (box.minBounds.z - cameraPos.z) / d.z;
-    float tzmax = (box.maxBounds.z - cameraPos.z) / d.z;
+    tEntry = tNear;
+    // Note: Written as a negated comparison so that NaN bounds keep the box
+    return !(tNear > tFar);
+}
 
-    if (tzmin > tzmax) std::swap(tzmin, tzmax);
+// Closest-hit traversal of a mesh BVH
+// Note: Leaves with more than 8 triangles are tested in groups of 8. Hits are accepted in the order of the
+//       primitive list, so the same triangle is returned as when testing the triangles one by one.
+int BVH::closestTriangle(const Ray& ray, float& t) const {
+    glm::vec3 origin(ray.origin);
+    glm::vec3 direction(ray.direction);
+
+    auto intersectLeaf = [&](int offset, int count, float& tClosest) {
+        int closest = -1;
+        for (int first = offset; first < offset + count; first += TRIANGLE_SIMD_WIDTH) {
+            int groupSize = std::min(offset + count - first, TRIANGLE_SIMD_WIDTH);
+            float tHit[TRIANGLE_SIMD_WIDTH];
+            int mask = intersectTriangles(triangles, first, groupSize, origin, direction, tHit);
+            for (int lane = 0; mask != 0 && lane < groupSize; lane++) {
+                if ((mask & (1 << lane)) && tHit[lane] > ray.tMin && tHit[lane] < tClosest) {
+                    tClosest = tHit[lane];
+                    closest = primitiveIndices[first + lane];
+                }
+            }
+        }
+        return closest;
+    };
+    return closestHitLeaves(ray, t, intersectLeaf);
+}
 
-    if ((tmin > tzmax) || (tzmin > tmax)) return false;
+// Any-hit traversal of a mesh BVH for occlusion queries
+int BVH::anyTriangle(const Ray& ray, float& t) const {
+    glm::vec3 origin(ray.origin);
+    glm::vec3 direction(ray.direction);
+    int hit = -1;
+
+    auto intersectLeaf = [&](int offset, int count, float tMax) {
+        for (int first = offset; first < offset + count; first += TRIANGLE_SIMD_WIDTH) {
+            int groupSize = std::min(offset + count - first, TRIANGLE_SIMD_WIDTH);
+            float tHit[TRIANGLE_SIMD_WIDTH];
+            int mask = intersectTriangles(triangles, first, groupSize, origin, direction, tHit);
+            for (int lane = 0; mask != 0 && lane < groupSize; lane++) {
+                if ((mask & (1 << lane)) && tHit[lane] > ray.tMin && tHit[lane] < tMax) {
+                    t = tHit[lane];
+                    hit = primitiveIndices[first + lane];
+                    return true;
+                }
+            }
+        }
+        return false;
+    };
+    anyHitLeaves(ray, intersectLeaf);
+    return hit;
+}
 
-    return true;
+const glm::vec3& BVH::triangleNormal(int triangleIndex) const {
+    return triangles.normals[triangleIndex];
 }
 
 void BVH::deleteNode(BVHNode* node) {
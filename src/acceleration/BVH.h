@@ -1,31 +1,511 @@
 #pragma once
 
 #include "BVHNode.h"
+#include "TriangleSoA.h"
 #include "utils/sceneparser.h"
 #include "primitive/meshcache.h"
+#include "utils/ray.h"
 
 #include <vector>
 #include <numeric>
+#include <algorithm>
 
 
+// Method used to choose where a node is divided while building the BVH
+enum class BVHSplitMethod {
+    SAH,    // Binned surface area heuristic
+    Median  // Median of the centroids along the longest axis
+};
+
+// Options for building the BVH
+struct BVHBuildOptions {
+    BVHSplitMethod splitMethod = BVHSplitMethod::SAH;
+    int maxLeafSize = 8; // Maximum number of primitives in a leaf, the SAH builder may choose smaller leaves
+    int width = 2;       // Number of children of a node: 2, 4 or 8
+};
+
 class BVH {
 public:
-    BVH(const std::vector<RenderShapeData>& shapes);
-    BVH(const Mesh& mesh);
+    BVH(const std::vector<RenderShapeData>& shapes, const BVHBuildOptions& options = BVHBuildOptions());
+    BVH(const Mesh& mesh, const BVHBuildOptions& options = BVHBuildOptions());
     ~BVH();
-    std::vector<RenderShapeData> potentialIntersections(const glm::vec4& cameraPos, const glm::vec4& d) const;
     bool intersects(const AABB& box, const glm::vec4& cameraPos, const glm::vec4& d) const;
-    std::vector<int> potentialIntersectionsForMesh(const glm::vec4& cameraPos, const glm::vec4& d) const;
+
+    // Find the closest primitive (shape or triangle index) hit by the ray within (tMin, tMax), or -1 if nothing is hit.
+    // @param t          On return the distance of the closest hit.
+    // @param intersect  Callable (int index, float tMax) -> float returning the hit distance of a primitive,
+    //                   hits outside (tMin, tMax) are ignored.
+    template <typename Intersector>
+    int closestHit(const Ray& ray, float& t, Intersector&& intersect) const;
+
+    // Check whether any primitive is hit by the ray within (tMin, tMax), stopping at the first hit found.
+    // @param intersect  Same as for closestHit.
+    template <typename Intersector>
+    bool anyHit(const Ray& ray, Intersector&& intersect) const;
+
+    // Find the closest primitive hit by each ray of a coherent packet, the rays traverse the tree together.
+    // @param t          On return the distance of the closest hit of each ray.
+    // @param closest    On return the index of the closest primitive of each ray, or -1 if nothing is hit.
+    // @param intersect  Callable (int ray, int index, float tMax) -> float returning the hit distance of a primitive
+    //                   for a ray of the packet, hits outside (tMin, tMax) of the ray are ignored.
+    template <typename Intersector>
+    void closestHitPacket(const RayPacket& packet, float t[], int closest[], Intersector&& intersect) const;
+
+    // Find the closest triangle hit by the ray within (tMin, tMax), or -1 if nothing is hit.
+    // Note: Only for a BVH built over a mesh. The triangles of each leaf are tested together with the SIMD triangle test.
+    // @param t  On return the distance of the closest hit.
+    int closestTriangle(const Ray& ray, float& t) const;
+
+    // Find any triangle hit by the ray within (tMin, tMax), or -1 if nothing is hit.
+    // @param t  On return the distance of the hit.
+    int anyTriangle(const Ray& ray, float& t) const;
+
+    // Normalized face normal of a triangle in object space
+    const glm::vec3& triangleNormal(int triangleIndex) const;
+
+    // Bounding box of all primitives in the tree
+    AABB bounds() const;
+
+    // Size of the flattened tree
+    int width() const;
+    size_t nodeCount() const;
+    size_t memoryUsage() const;
 
 private:
-    BVHNode* root;
-    std::vector<RenderShapeData> originalShapes;
+    BVHBuildOptions options;
+    std::vector<LinearBVHNode> nodes;      // Flattened binary tree in depth-first order (width 2)
+    std::vector<WideBVHNode<4>> nodes4;    // Collapsed tree (width 4)
+    std::vector<WideBVHNode<8>> nodes8;    // Collapsed tree (width 8)
+    std::vector<int> primitiveIndices;     // Shape or triangle indices referenced by the leaf ranges
+    TriangleSoA triangles;                 // Triangles of a mesh in the order of primitiveIndices
+    int leafGroupSize = 1;                 // Number of primitives of a leaf that are intersected together
 
-    BVHNode* build(std::vector<int>& indices);
-    BVHNode* buildForMesh(const Mesh& mesh, std::vector<int>& indices);
+    void buildTree(std::vector<BVHPrimitive>& primitives);
+    BVHNode* build(std::vector<BVHPrimitive>& primitives, int start, int end, int depth);
+    int partitionMedian(std::vector<BVHPrimitive>& primitives, int start, int end, int axis);
+    // Best SAH split of a node: primitives in bins up to bin along axis go to the left child
+    struct SAHSplit {
+        int axis = -1;         // -1 if no split is found
+        int bin = -1;
+        float cost = INFINITY; // Expected cost relative to intersecting one primitive group
+    };
+    SAHSplit findSAHSplit(const std::vector<BVHPrimitive>& primitives, int start, int end, const AABB& bounds, const AABB& centroidBounds) const;
+    int partitionSAH(std::vector<BVHPrimitive>& primitives, int start, int end, const AABB& centroidBounds, const SAHSplit& split);
+    int groupCount(int primitiveCount) const;
     void deleteNode(BVHNode* node);
+    int flatten(BVHNode* node);
+    template <int N>
+    int collapse(BVHNode* node, std::vector<WideBVHNode<N>>& wideNodes);
     AABB computeAABBForShape(const RenderShapeData& shape);
     AABB computeAABBForTriangle(const Mesh& mesh, int triangleIndex);
-    void potentialIntersectionsRecursive(BVHNode* node, const glm::vec4& cameraPos, const glm::vec4& d, std::vector<RenderShapeData>& potentialShapes) const;
-    void potentialIntersectionsRecursiveForMesh(BVHNode* node, const glm::vec4& cameraPos, const glm::vec4& d, std::vector<int>& potentialTriangles) const;
+    bool intersects(const AABB& box, const Ray& ray, float tMax) const;
+
+    // Traversals which call intersectLeaf(int offset, int count, float& t) -> int (closest primitive index or -1)
+    // or intersectLeaf(int offset, int count, float tMax) -> bool for the primitive range of each leaf that is hit
+    template <typename LeafIntersector>
+    int closestHitLeaves(const Ray& ray, float& t, LeafIntersector&& intersectLeaf) const;
+    template <typename LeafIntersector>
+    bool anyHitLeaves(const Ray& ray, LeafIntersector&& intersectLeaf) const;
+    template <typename LeafIntersector>
+    int closestHitBinary(const Ray& ray, float& t, LeafIntersector&& intersectLeaf) const;
+    template <typename LeafIntersector>
+    bool anyHitBinary(const Ray& ray, LeafIntersector&& intersectLeaf) const;
+    template <int N, typename LeafIntersector>
+    int closestHitWide(const std::vector<WideBVHNode<N>>& wideNodes, const Ray& ray, float& t, LeafIntersector&& intersectLeaf) const;
+    template <int N, typename LeafIntersector>
+    bool anyHitWide(const std::vector<WideBVHNode<N>>& wideNodes, const Ray& ray, LeafIntersector&& intersectLeaf) const;
+
+    // Bounds of the origins and reciprocal directions of the rays of a packet for the interval slab test
+    struct PacketInterval {
+        glm::vec3 originMin, originMax;
+        glm::vec3 invDMin, invDMax;
+        bool axisValid[3]; // The reciprocal directions along the axis are finite and have the same sign
+    };
+    static PacketInterval packetInterval(const RayPacket& packet);
+    static bool intersects(const AABB& box, const PacketInterval& interval, float tMax, float& tEntry);
+
+    // Packet traversals which call intersectLeaf(const AABB& bounds, int offset, int count) for each leaf that
+    // may be hit by a ray of the packet within packetTMax
+    template <typename LeafIntersector>
+    void closestHitPacketBinary(const PacketInterval& interval, const float& packetTMax, LeafIntersector&& intersectLeaf) const;
+    template <int N, typename LeafIntersector>
+    void closestHitPacketWide(const std::vector<WideBVHNode<N>>& wideNodes, const PacketInterval& interval, const float& packetTMax, LeafIntersector&& intersectLeaf) const;
 };
+
+// Closest-hit traversal
+// Note: Primitives are intersected while traversing. Children are visited front-to-back along the split axis and
+//       boxes that start beyond the closest hit found so far are skipped.
+template <typename LeafIntersector>
+int BVH::closestHitBinary(const Ray& ray, float& t, LeafIntersector&& intersectLeaf) const {
+    int closest = -1;
+    t = ray.tMax;
+    if (nodes.empty()) {
+        return closest;
+    }
+
+
+    int stack[64];
+    int stackSize = 0;
+    int current = 0;
+    while (true) {
+        const LinearBVHNode& node = nodes[current];
+        if (intersects(node.bounds, ray, t)) {
+            if (node.primitiveCount > 0) {
+                int hit = intersectLeaf(node.primitivesOffset, node.primitiveCount, t);
+                if (hit >= 0) {
+                    closest = hit;
+                }
+            } else {
+                // Visit the near child next and leave the far child on the stack
+                if (ray.sign[node.axis]) {
+                    stack[stackSize++] = current + 1;
+                    current = node.secondChildOffset;
+                } else {
+                    stack[stackSize++] = node.secondChildOffset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stackSize == 0) {
+            break;
+        }
+        current = stack[--stackSize];
+    }
+
+    return closest;
+}
+
+// Any-hit traversal for occlusion queries
+// Note: The order of visiting does not matter since the traversal terminates on the first hit.
+template <typename LeafIntersector>
+bool BVH::anyHitBinary(const Ray& ray, LeafIntersector&& intersectLeaf) const {
+    if (nodes.empty()) {
+        return false;
+    }
+
+    const float tMax = ray.tMax;
+
+    int stack[64];
+    int stackSize = 0;
+    int current = 0;
+    while (true) {
+        const LinearBVHNode& node = nodes[current];
+        if (intersects(node.bounds, ray, tMax)) {
+            if (node.primitiveCount > 0) {
+                if (intersectLeaf(node.primitivesOffset, node.primitiveCount, tMax)) {
+                    return true;
+                }
+            } else {
+                stack[stackSize++] = node.secondChildOffset;
+                current = current + 1;
+                continue;
+            }
+        }
+
+        if (stackSize == 0) {
+            break;
+        }
+        current = stack[--stackSize];
+    }
+
+    return false;
+}
+
+template <typename Intersector>
+int BVH::closestHit(const Ray& ray, float& t, Intersector&& intersect) const {
+    // Intersect the primitives of a leaf one by one
+    auto intersectLeaf = [&](int offset, int count, float& tClosest) {
+        int closest = -1;
+        for (int i = 0; i < count; i++) {
+            int index = primitiveIndices[offset + i];
+            float tHit = intersect(index, tClosest);
+            if (tHit > ray.tMin && tHit < tClosest) {
+                tClosest = tHit;
+                closest = index;
+            }
+        }
+        return closest;
+    };
+    return closestHitLeaves(ray, t, intersectLeaf);
+}
+
+template <typename Intersector>
+bool BVH::anyHit(const Ray& ray, Intersector&& intersect) const {
+    auto intersectLeaf = [&](int offset, int count, float tMax) {
+        for (int i = 0; i < count; i++) {
+            float tHit = intersect(primitiveIndices[offset + i], tMax);
+            if (tHit > ray.tMin && tHit < tMax) {
+                return true;
+            }
+        }
+        return false;
+    };
+    return anyHitLeaves(ray, intersectLeaf);
+}
+
+template <typename LeafIntersector>
+int BVH::closestHitLeaves(const Ray& ray, float& t, LeafIntersector&& intersectLeaf) const {
+    switch (options.width) {
+        case 4:
+            return closestHitWide(nodes4, ray, t, intersectLeaf);
+        case 8:
+            return closestHitWide(nodes8, ray, t, intersectLeaf);
+        default:
+            return closestHitBinary(ray, t, intersectLeaf);
+    }
+}
+
+template <typename LeafIntersector>
+bool BVH::anyHitLeaves(const Ray& ray, LeafIntersector&& intersectLeaf) const {
+    switch (options.width) {
+        case 4:
+            return anyHitWide(nodes4, ray, intersectLeaf);
+        case 8:
+            return anyHitWide(nodes8, ray, intersectLeaf);
+        default:
+            return anyHitBinary(ray, intersectLeaf);
+    }
+}
+
+// Closest-hit traversal of the collapsed tree
+// Note: All children of a node are tested with one SIMD box test. Leaf children are intersected right away and
+//       interior children are pushed far-to-near with their entry distance, so that nodes which start beyond
+//       the closest hit found meanwhile are skipped when they are popped.
+template <int N, typename LeafIntersector>
+int BVH::closestHitWide(const std::vector<WideBVHNode<N>>& wideNodes, const Ray& ray, float& t, LeafIntersector&& intersectLeaf) const {
+    int closest = -1;
+    t = ray.tMax;
+    if (wideNodes.empty()) {
+        return closest;
+    }
+
+    struct StackEntry {
+        int node;
+        float tEntry;
+    };
+    StackEntry stack[64 * (N - 1) + 1];
+    int stackSize = 0;
+    stack[stackSize++] = {0, 0.0f};
+
+    while (stackSize > 0) {
+        StackEntry entry = stack[--stackSize];
+        if (entry.tEntry > t) {
+            continue;
+        }
+
+        const WideBVHNode<N>& node = wideNodes[entry.node];
+        float tEntry[N];
+        int mask = intersectAABB(node.childBounds, ray, t, tEntry);
+
+        // Intersect the leaves and collect the interior children that are hit
+        StackEntry children[N];
+        int childCount = 0;
+        for (int i = 0; i < node.numChildren; i++) {
+            if (!(mask & (1 << i))) {
+                continue;
+            }
+            if (node.childCount[i] > 0) {
+                int hit = intersectLeaf(node.childOffset[i], node.childCount[i], t);
+                if (hit >= 0) {
+                    closest = hit;
+                }
+            } else {
+                // Insertion sort by decreasing entry distance
+                int k = childCount++;
+                while (k > 0 && children[k - 1].tEntry < tEntry[i]) {
+                    children[k] = children[k - 1];
+                    k--;
+                }
+                children[k] = {node.childOffset[i], tEntry[i]};
+            }
+        }
+
+        // Push far-to-near so that the nearest child is visited next
+        for (int i = 0; i < childCount; i++) {
+            stack[stackSize++] = children[i];
+        }
+    }
+
+    return closest;
+}
+
+// Any-hit traversal of the collapsed tree for occlusion queries
+template <int N, typename LeafIntersector>
+bool BVH::anyHitWide(const std::vector<WideBVHNode<N>>& wideNodes, const Ray& ray, LeafIntersector&& intersectLeaf) const {
+    if (wideNodes.empty()) {
+        return false;
+    }
+
+    const float tMax = ray.tMax;
+
+    int stack[64 * (N - 1) + 1];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        const WideBVHNode<N>& node = wideNodes[stack[--stackSize]];
+        float tEntry[N];
+        int mask = intersectAABB(node.childBounds, ray, tMax, tEntry);
+
+        for (int i = 0; i < node.numChildren; i++) {
+            if (!(mask & (1 << i))) {
+                continue;
+            }
+            if (node.childCount[i] > 0) {
+                if (intersectLeaf(node.childOffset[i], node.childCount[i], tMax)) {
+                    return true;
+                }
+            } else {
+                stack[stackSize++] = node.childOffset[i];
+            }
+        }
+    }
+
+    return false;
+}
+
+// Closest-hit traversal of a packet of coherent rays (e.g. the primary rays of a pixel tile)
+// Note: Nodes are culled for the whole packet with interval arithmetic on the bounds of the ray origins and directions,
+//       so the box tests are shared by all rays. At the leaves, each ray is tested against the leaf box and the
+//       primitives individually with its own closest hit distance.
+template <typename Intersector>
+void BVH::closestHitPacket(const RayPacket& packet, float t[], int closest[], Intersector&& intersect) const {
+    float packetTMax = 0; // Largest closest hit distance of the rays, boxes beyond it are culled
+    for (int r = 0; r < packet.size; r++) {
+        t[r] = packet.rays[r].tMax;
+        closest[r] = -1;
+        packetTMax = std::max(packetTMax, t[r]);
+    }
+    if (packet.size == 0) {
+        return;
+    }
+
+    auto intersectLeaf = [&](const AABB& bounds, int offset, int count) {
+        // Split off the rays that hit the leaf box
+        int rays[RAY_PACKET_SIZE];
+        int rayCount = 0;
+        for (int r = 0; r < packet.size; r++) {
+            if (intersects(bounds, packet.rays[r], t[r])) {
+                rays[rayCount++] = r;
+            }
+        }
+
+        for (int i = 0; i < count && rayCount > 0; i++) {
+            int index = primitiveIndices[offset + i];
+            for (int k = 0; k < rayCount; k++) {
+                int r = rays[k];
+                float tHit = intersect(r, index, t[r]);
+                if (tHit > packet.rays[r].tMin && tHit < t[r]) {
+                    t[r] = tHit;
+                    closest[r] = index;
+                }
+            }
+        }
+
+        packetTMax = 0;
+        for (int r = 0; r < packet.size; r++) {
+            packetTMax = std::max(packetTMax, t[r]);
+        }
+    };
+
+    PacketInterval interval = packetInterval(packet);
+    switch (options.width) {
+        case 4:
+            closestHitPacketWide(nodes4, interval, packetTMax, intersectLeaf);
+            break;
+        case 8:
+            closestHitPacketWide(nodes8, interval, packetTMax, intersectLeaf);
+            break;
+        default:
+            closestHitPacketBinary(interval, packetTMax, intersectLeaf);
+            break;
+    }
+}
+
+template <typename LeafIntersector>
+void BVH::closestHitPacketBinary(const PacketInterval& interval, const float& packetTMax, LeafIntersector&& intersectLeaf) const {
+    if (nodes.empty()) {
+        return;
+    }
+
+    // Note: The rays of a packet are coherent, so the children are ordered for the direction of the rays along the split axis
+    bool dirIsNeg[3] = {interval.invDMax.x < 0, interval.invDMax.y < 0, interval.invDMax.z < 0};
+
+    int stack[64];
+    int stackSize = 0;
+    int current = 0;
+    while (true) {
+        const LinearBVHNode& node = nodes[current];
+        float tEntry;
+        if (intersects(node.bounds, interval, packetTMax, tEntry)) {
+            if (node.primitiveCount > 0) {
+                intersectLeaf(node.bounds, node.primitivesOffset, node.primitiveCount);
+            } else {
+                if (dirIsNeg[node.axis]) {
+                    stack[stackSize++] = current + 1;
+                    current = node.secondChildOffset;
+                } else {
+                    stack[stackSize++] = node.secondChildOffset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stackSize == 0) {
+            break;
+        }
+        current = stack[--stackSize];
+    }
+}
+
+template <int N, typename LeafIntersector>
+void BVH::closestHitPacketWide(const std::vector<WideBVHNode<N>>& wideNodes, const PacketInterval& interval, const float& packetTMax, LeafIntersector&& intersectLeaf) const {
+    if (wideNodes.empty()) {
+        return;
+    }
+
+    struct StackEntry {
+        int node;
+        float tEntry;
+    };
+    StackEntry stack[64 * (N - 1) + 1];
+    int stackSize = 0;
+    stack[stackSize++] = {0, 0.0f};
+
+    while (stackSize > 0) {
+        StackEntry entry = stack[--stackSize];
+        if (entry.tEntry > packetTMax) {
+            continue;
+        }
+
+        const WideBVHNode<N>& node = wideNodes[entry.node];
+        StackEntry children[N];
+        int childCount = 0;
+        for (int i = 0; i < node.numChildren; i++) {
+            AABB bounds = node.childBounds.get(i);
+            float tEntry;
+            if (!intersects(bounds, interval, packetTMax, tEntry)) {
+                continue;
+            }
+            if (node.childCount[i] > 0) {
+                intersectLeaf(bounds, node.childOffset[i], node.childCount[i]);
+            } else {
+                // Insertion sort by decreasing entry distance
+                int k = childCount++;
+                while (k > 0 && children[k - 1].tEntry < tEntry) {
+                    children[k] = children[k - 1];
+                    k--;
+                }
+                children[k] = {node.childOffset[i], tEntry};
+            }
+        }
+
+        // Push far-to-near so that the nearest child is visited next
+        for (int i = 0; i < childCount; i++) {
+            stack[stackSize++] = children[i];
+        }
+    }
+}
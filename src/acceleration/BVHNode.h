@@ -1,14 +1,53 @@
 #pragma once
 
 #include "AABB.h"
+#include "AABBSoA.h"
+#include <cstdint>
 
+// Node of the pointer tree that is used while building the BVH
 struct BVHNode {
     AABB bounds;
     BVHNode* left;
     BVHNode* right;
 
-    int shapeIndex;  // -1 for internal nodes
-    int triangleIndex = -1;
+    int primitivesOffset = 0; // Leaf: index of the first primitive in the ordered primitive list
+    int primitiveCount = 0;   // 0 for internal nodes
+    int splitAxis = 0;        // Axis along which an internal node is divided
 
-    BVHNode() : left(nullptr), right(nullptr), shapeIndex(-1) {}
+    BVHNode() : left(nullptr), right(nullptr) {}
+};
+
+// Precomputed bounds and centroid of a primitive (shape or triangle) that is used while building the BVH
+struct BVHPrimitive {
+    AABB bounds;
+    glm::vec3 centroid;
+    int index; // Index of the shape or triangle
+};
+
+// Compact node of the flattened BVH which is used for traversal
+// Note: Nodes are stored in depth-first order, so the left child of an interior node directly follows it
+//       and only the offset of the right child needs to be stored.
+struct LinearBVHNode {
+    AABB bounds;
+    union {
+        int primitivesOffset;  // Leaf: index of the first primitive in the primitive index list
+        int secondChildOffset; // Interior: index of the right child in the node list
+    };
+    std::uint16_t primitiveCount; // 0 for interior nodes
+    std::uint8_t axis;            // Split axis of interior nodes
+    std::uint8_t pad;
+};
+
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should fit in 32 bytes");
+
+// Node of the collapsed N-wide BVH which is used for traversal
+// Note: The bounds of all children are stored together in SoA layout, so they can be tested with one SIMD box test.
+//       A child is either an interior node (count 0, offset is its index in the node list) or a leaf (count > 0,
+//       offset is the index of its first primitive in the primitive index list).
+template <int N>
+struct WideBVHNode {
+    AABBSoA<N> childBounds;
+    int childOffset[N];
+    std::uint8_t childCount[N];
+    int numChildren = 0;
 };
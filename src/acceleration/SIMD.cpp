@@ -0,0 +1,53 @@
+#include "SIMD.h"
+
+#if defined(SIMD_X86) && defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+/******************************** Instruction set detection ********************************/
+SIMDLevel detectSIMDLevel() {
+#if defined(SIMD_X86) && defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    bool hasSSE42 = info[2] & (1 << 20);
+    bool hasOSXSave = info[2] & (1 << 27);
+    bool hasAVX = info[2] & (1 << 28);
+    __cpuidex(info, 7, 0);
+    bool hasAVX2 = info[1] & (1 << 5);
+
+    // Note: AVX registers also need to be enabled by the OS
+    if (hasAVX2 && hasAVX && hasOSXSave && (_xgetbv(0) & 6) == 6) {
+        return SIMDLevel::AVX2;
+    }
+    if (hasSSE42) {
+        return SIMDLevel::SSE42;
+    }
+#elif defined(SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SIMDLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return SIMDLevel::SSE42;
+    }
+#endif
+    return SIMDLevel::Scalar;
+}
+
+const char* simdLevelName(SIMDLevel level) {
+    switch (level) {
+        case SIMDLevel::AVX2:
+            return "AVX2";
+        case SIMDLevel::SSE42:
+            return "SSE4.2";
+        default:
+            return "scalar";
+    }
+}
+
+// Note: The detection runs once, the result is shared by all kernels
+SIMDLevel activeSIMDLevel() {
+    static const SIMDLevel level = detectSIMDLevel();
+    return level;
+}
+
@@ -0,0 +1,30 @@
+#pragma once
+
+// Instruction sets used by the SIMD kernels of the acceleration structures
+// Note: The kernels are compiled for their instruction set individually and selected at runtime, so the binary
+//       still runs on CPUs without AVX2. Kernel translation units use the TARGET_* attributes defined below.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET_SSE42
+#define TARGET_AVX2
+#else
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Instruction set used by the kernels, detected once at runtime
+enum class SIMDLevel {
+    Scalar,
+    SSE42,
+    AVX2
+};
+
+SIMDLevel detectSIMDLevel();
+const char* simdLevelName(SIMDLevel level);
+
+// The instruction set of this CPU (detected on the first call)
+SIMDLevel activeSIMDLevel();
@@ -0,0 +1,184 @@
+#include "TriangleSoA.h"
+
+// Hits closer than this are ignored
+static const float TRIANGLE_EPSILON = 0.0000001f;
+
+TriangleSoA::TriangleSoA(const Mesh& mesh, const std::vector<int>& order) {
+    // Note: The padding triangles have zero edges, so the determinant is 0 and they are never hit
+    size_t size = order.size() + TRIANGLE_SIMD_WIDTH - 1;
+    for (std::vector<float>* component : {&v0X, &v0Y, &v0Z, &e1X, &e1Y, &e1Z, &e2X, &e2Y, &e2Z}) {
+        component->assign(size, 0.0f);
+    }
+
+    for (size_t i = 0; i < order.size(); i++) {
+        const Face &face = mesh.faces[order[i]];
+        glm::vec3 v0 = mesh.vertices[face.v[0]];
+        glm::vec3 e1 = mesh.vertices[face.v[1]] - v0;
+        glm::vec3 e2 = mesh.vertices[face.v[2]] - v0;
+
+        v0X[i] = v0.x;
+        v0Y[i] = v0.y;
+        v0Z[i] = v0.z;
+        e1X[i] = e1.x;
+        e1Y[i] = e1.y;
+        e1Z[i] = e1.z;
+        e2X[i] = e2.x;
+        e2Y[i] = e2.y;
+        e2Z[i] = e2.z;
+    }
+
+    normals.resize(mesh.faces.size());
+    for (size_t i = 0; i < mesh.faces.size(); i++) {
+        const Face &face = mesh.faces[i];
+        glm::vec3 v0 = mesh.vertices[face.v[0]];
+        normals[i] = glm::normalize(glm::cross(mesh.vertices[face.v[1]] - v0, mesh.vertices[face.v[2]] - v0));
+    }
+}
+
+size_t TriangleSoA::memoryUsage() const {
+    return 9 * v0X.size() * sizeof(float) + normals.size() * sizeof(glm::vec3);
+}
+
+/******************************** Scalar kernel ********************************/
+// Note: The operations are done in the same order as by the SIMD kernels (and glm::cross/glm::dot), which keeps
+//       the results identical. Written with negated comparisons so that NaN lanes behave like the SIMD masks.
+static int intersectScalar(const TriangleSoA& triangles, int first, int count, const glm::vec3& origin, const glm::vec3& direction, float* tHit) {
+    int mask = 0;
+    for (int lane = 0; lane < count; lane++) {
+        int i = first + lane;
+        glm::vec3 e1(triangles.e1X[i], triangles.e1Y[i], triangles.e1Z[i]);
+        glm::vec3 e2(triangles.e2X[i], triangles.e2Y[i], triangles.e2Z[i]);
+
+        glm::vec3 h = glm::cross(direction, e2);
+        float a = glm::dot(e1, h);
+        float f = 1.0f / a;
+        glm::vec3 s = origin - glm::vec3(triangles.v0X[i], triangles.v0Y[i], triangles.v0Z[i]);
+        float u = f * glm::dot(s, h);
+        glm::vec3 q = glm::cross(s, e1);
+        float v = f * glm::dot(direction, q);
+        float t = f * glm::dot(e2, q);
+
+        tHit[lane] = t;
+        bool miss = (a > -TRIANGLE_EPSILON && a < TRIANGLE_EPSILON) || u < 0.0f || u > 1.0f || v < 0.0f || u + v > 1.0f;
+        if (!miss && t > TRIANGLE_EPSILON) {
+            mask |= 1 << lane;
+        }
+    }
+    return mask;
+}
+
+/******************************** SIMD kernels ********************************/
+#ifdef SIMD_X86
+// Test 4 triangles starting at position first
+TARGET_SSE42 static int intersectSSE(const TriangleSoA& triangles, int first, const glm::vec3& origin, const glm::vec3& direction, float* tHit) {
+    __m128 dx = _mm_set1_ps(direction.x);
+    __m128 dy = _mm_set1_ps(direction.y);
+    __m128 dz = _mm_set1_ps(direction.z);
+
+    __m128 e1x = _mm_loadu_ps(triangles.e1X.data() + first);
+    __m128 e1y = _mm_loadu_ps(triangles.e1Y.data() + first);
+    __m128 e1z = _mm_loadu_ps(triangles.e1Z.data() + first);
+    __m128 e2x = _mm_loadu_ps(triangles.e2X.data() + first);
+    __m128 e2y = _mm_loadu_ps(triangles.e2Y.data() + first);
+    __m128 e2z = _mm_loadu_ps(triangles.e2Z.data() + first);
+
+    // h = cross(d, e2), a = dot(e1, h)
+    __m128 hx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz));
+    __m128 hy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx));
+    __m128 hz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+    __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx), _mm_mul_ps(e1y, hy)), _mm_mul_ps(e1z, hz));
+    __m128 f = _mm_div_ps(_mm_set1_ps(1.0f), a);
+
+    // s = o - v0, u = f * dot(s, h)
+    __m128 sx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_loadu_ps(triangles.v0X.data() + first));
+    __m128 sy = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_loadu_ps(triangles.v0Y.data() + first));
+    __m128 sz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_loadu_ps(triangles.v0Z.data() + first));
+    __m128 u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx), _mm_mul_ps(sy, hy)), _mm_mul_ps(sz, hz)));
+
+    // q = cross(s, e1), v = f * dot(d, q), t = f * dot(e2, q)
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(e1y, sz));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(e1z, sx));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(e1x, sy));
+    __m128 v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)));
+    __m128 t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 epsilon = _mm_set1_ps(TRIANGLE_EPSILON);
+    __m128 parallel = _mm_and_ps(_mm_cmpgt_ps(a, _mm_set1_ps(-TRIANGLE_EPSILON)), _mm_cmplt_ps(a, epsilon));
+    __m128 outside = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmpgt_ps(u, one)),
+                               _mm_or_ps(_mm_cmplt_ps(v, zero), _mm_cmpgt_ps(_mm_add_ps(u, v), one)));
+    __m128 hit = _mm_andnot_ps(_mm_or_ps(parallel, outside), _mm_cmpgt_ps(t, epsilon));
+
+    _mm_storeu_ps(tHit, t);
+    return _mm_movemask_ps(hit);
+}
+
+// Test 8 triangles starting at position first
+TARGET_AVX2 static int intersectAVX2(const TriangleSoA& triangles, int first, const glm::vec3& origin, const glm::vec3& direction, float* tHit) {
+    __m256 dx = _mm256_set1_ps(direction.x);
+    __m256 dy = _mm256_set1_ps(direction.y);
+    __m256 dz = _mm256_set1_ps(direction.z);
+
+    __m256 e1x = _mm256_loadu_ps(triangles.e1X.data() + first);
+    __m256 e1y = _mm256_loadu_ps(triangles.e1Y.data() + first);
+    __m256 e1z = _mm256_loadu_ps(triangles.e1Z.data() + first);
+    __m256 e2x = _mm256_loadu_ps(triangles.e2X.data() + first);
+    __m256 e2y = _mm256_loadu_ps(triangles.e2Y.data() + first);
+    __m256 e2z = _mm256_loadu_ps(triangles.e2Z.data() + first);
+
+    // h = cross(d, e2), a = dot(e1, h)
+    __m256 hx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(e2y, dz));
+    __m256 hy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(e2z, dx));
+    __m256 hz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(e2x, dy));
+    __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, hx), _mm256_mul_ps(e1y, hy)), _mm256_mul_ps(e1z, hz));
+    __m256 f = _mm256_div_ps(_mm256_set1_ps(1.0f), a);
+
+    // s = o - v0, u = f * dot(s, h)
+    __m256 sx = _mm256_sub_ps(_mm256_set1_ps(origin.x), _mm256_loadu_ps(triangles.v0X.data() + first));
+    __m256 sy = _mm256_sub_ps(_mm256_set1_ps(origin.y), _mm256_loadu_ps(triangles.v0Y.data() + first));
+    __m256 sz = _mm256_sub_ps(_mm256_set1_ps(origin.z), _mm256_loadu_ps(triangles.v0Z.data() + first));
+    __m256 u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, hx), _mm256_mul_ps(sy, hy)), _mm256_mul_ps(sz, hz)));
+
+    // q = cross(s, e1), v = f * dot(d, q), t = f * dot(e2, q)
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(e1y, sz));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(e1z, sx));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(e1x, sy));
+    __m256 v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)));
+    __m256 t = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)));
+
+    __m256 zero = _mm256_setzero_ps();
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 epsilon = _mm256_set1_ps(TRIANGLE_EPSILON);
+    __m256 parallel = _mm256_and_ps(_mm256_cmp_ps(a, _mm256_set1_ps(-TRIANGLE_EPSILON), _CMP_GT_OQ), _mm256_cmp_ps(a, epsilon, _CMP_LT_OQ));
+    __m256 outside = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_LT_OQ), _mm256_cmp_ps(u, one, _CMP_GT_OQ)),
+                                  _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_GT_OQ)));
+    __m256 hit = _mm256_andnot_ps(_mm256_or_ps(parallel, outside), _mm256_cmp_ps(t, epsilon, _CMP_GT_OQ));
+
+    _mm256_storeu_ps(tHit, t);
+    return _mm256_movemask_ps(hit);
+}
+#endif
+
+/******************************** Dispatch ********************************/
+// Note: The SIMD kernels always test full registers, the lanes beyond count are masked out
+int intersectTriangles(SIMDLevel level, const TriangleSoA& triangles, int first, int count, const glm::vec3& origin, const glm::vec3& direction, float tHit[8]) {
+    int countMask = (1 << count) - 1;
+#ifdef SIMD_X86
+    if (level == SIMDLevel::AVX2 && count > 4) {
+        return intersectAVX2(triangles, first, origin, direction, tHit) & countMask;
+    }
+    if (level != SIMDLevel::Scalar) {
+        int mask = intersectSSE(triangles, first, origin, direction, tHit);
+        if (count > 4) {
+            mask |= intersectSSE(triangles, first + 4, origin, direction, tHit + 4) << 4;
+        }
+        return mask & countMask;
+    }
+#endif
+    return intersectScalar(triangles, first, count, origin, direction, tHit);
+}
+
+int intersectTriangles(const TriangleSoA& triangles, int first, int count, const glm::vec3& origin, const glm::vec3& direction, float tHit[8]) {
+    return intersectTriangles(activeSIMDLevel(), triangles, first, count, origin, direction, tHit);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "SIMD.h"
+#include "primitive/mesh.h"
+
+// Precomputed triangles of a mesh in structure-of-arrays layout, so that one ray can be tested against several
+// triangles with SIMD instructions
+// Note: Each triangle is stored as its first vertex and its two edges, so the edges are not recomputed for every test.
+//       The triangles are stored in the order of the primitive list of the triangle BVH, so the triangles of a leaf
+//       are contiguous and can be loaded directly. The arrays are padded with degenerate triangles which are never
+//       hit, so that a full SIMD register can be loaded at the last leaf.
+struct TriangleSoA {
+    std::vector<float> v0X, v0Y, v0Z;
+    std::vector<float> e1X, e1Y, e1Z;
+    std::vector<float> e2X, e2Y, e2Z;
+    std::vector<glm::vec3> normals; // Normalized face normal of each triangle, indexed by the triangle index
+
+    TriangleSoA() = default;
+
+    // @param order  Triangle index at each position, i.e. the primitive list of the BVH
+    TriangleSoA(const Mesh& mesh, const std::vector<int>& order);
+
+    size_t memoryUsage() const;
+};
+
+// Maximum number of triangles tested by one call of intersectTriangles
+static const int TRIANGLE_SIMD_WIDTH = 8;
+
+// Möller–Trumbore test of a ray against the triangles at positions [first, first + count) with count <= 8
+// Returns a bit mask of the triangles that are hit in front of the ray and their distances in tHit
+// Note: Only the distance is computed, the normal of the closest hit is looked up in normals. Hits at t <= 1e-7 are ignored.
+//       The SIMD kernel is selected at runtime, all kernels (including the scalar fallback) give identical results.
+int intersectTriangles(const TriangleSoA& triangles, int first, int count, const glm::vec3& origin, const glm::vec3& direction, float tHit[8]);
+
+// Kernels for a given instruction set, the level must be supported by the CPU
+int intersectTriangles(SIMDLevel level, const TriangleSoA& triangles, int first, int count, const glm::vec3& origin, const glm::vec3& direction, float tHit[8]);
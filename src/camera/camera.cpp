@@ -37,6 +37,7 @@ void Camera::calculateViewMatrix() {
     glm::mat4 matTranslate = glm::mat4(glm::vec4(1, 0, 0, 0), glm::vec4(0, 1, 0, 0), glm::vec4(0, 0, 1, 0), glm::vec4(-cameraPos.xyz(), 1));
 
     viewMatrix = matRotate * matTranslate;
+    viewMatrixInverse = glm::inverse(viewMatrix);
 
     for (int i = 0; i < 4; ++i) {
         for (int j = 0; j < 4; ++j) {
@@ -46,12 +47,12 @@ void Camera::calculateViewMatrix() {
     }
 }
 
-glm::mat4 Camera::getViewMatrix() const {
+const glm::mat4& Camera::getViewMatrix() const {
     return viewMatrix;
 }
 
-glm::mat4 Camera::getViewMatrixInverse() const {
-    return glm::inverse(viewMatrix);
+const glm::mat4& Camera::getViewMatrixInverse() const {
+    return viewMatrixInverse;
 }
 
 float Camera::getAspectRatio() const {
@@ -15,6 +15,7 @@ public:
     glm::vec4 cameraUp;
 
     glm::mat4 viewMatrix;
+    glm::mat4 viewMatrixInverse; // Precomputed with the view matrix
     float aspectRatio;
 
     float cameraHeightAngle; // The height angle of the camera in RADIANS
@@ -28,8 +29,8 @@ public:
 
     // Returns the view matrix for the current camera settings.
     // You might also want to define another function that return the inverse of the view matrix.
-    glm::mat4 getViewMatrix() const;
-    glm::mat4 getViewMatrixInverse() const;
+    const glm::mat4& getViewMatrix() const;
+    const glm::mat4& getViewMatrixInverse() const;
 
     // Returns the aspect ratio of the camera.
     float getAspectRatio() const;
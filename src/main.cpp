@@ -3,6 +3,7 @@
 #include <QImage>
 #include <QtCore>
 
+#include <algorithm>
 #include <iostream>
 #include "utils/sceneparser.h"
 #include "raytracer/raytracer.h"
@@ -27,6 +28,7 @@ int main(int argc, char *argv[])
     QSettings settings( positionalArgs[0], QSettings::IniFormat );
     QString iScenePath = settings.value("IO/scene").toString();
     QString oImagePath = settings.value("IO/output").toString();
+    QString oSampleMapPath = settings.value("IO/sample-map").toString();
 
     RenderData metaData;
     bool success = SceneParser::parse(iScenePath.toStdString(), metaData);
@@ -61,6 +63,26 @@ int main(int argc, char *argv[])
     rtConfig.maxRecursiveDepth   = settings.value("Settings/maximum-recursive-depth").toInt();
     rtConfig.onlyRenderNormals   = settings.value("Settings/only-render-normals").toBool();
     rtConfig.enableSoftShadows   = settings.value("Settings/softshadows").toBool();
+    rtConfig.softShadowMaxSamples = std::max(settings.value("Settings/softshadow-samples", 20).toInt(), 4); // At least the 4 probes
+    rtConfig.minThroughput       = settings.value("Settings/min-throughput", 0.01f).toFloat();
+    rtConfig.numThreads          = settings.value("Settings/num-threads", 0).toInt();
+    rtConfig.blockSize           = std::max(settings.value("Settings/block-size", 32).toInt(), 1); // A block covers at least one pixel
+    rtConfig.enableCenterFirst   = settings.value("Settings/center-first", true).toBool();
+    rtConfig.enableSAH           = settings.value("Settings/bvh-sah", true).toBool();
+    rtConfig.bvhMaxLeafSize      = std::clamp(settings.value("Settings/bvh-leaf-size", 8).toInt(), 1, 255); // Range the BVH builder supports
+    rtConfig.bvhWidth            = settings.value("Settings/bvh-width", 4).toInt();
+    rtConfig.enableRayPackets    = settings.value("Settings/ray-packets", true).toBool();
+    rtConfig.enableWavefront     = settings.value("Settings/wavefront", false).toBool();
+    rtConfig.superSampleThreshold = settings.value("Settings/super-sample-threshold", 0.1f).toFloat();
+    rtConfig.superSampleMaxDepth = std::clamp(settings.value("Settings/super-sample-depth", 1).toInt(), 0, 8); // Seeds use a grid of 2^depth per pixel
+    rtConfig.adaptiveMaxSamples  = std::max(settings.value("Settings/adaptive-max-samples", 16).toInt(), 1); // At least one sample per pixel
+    rtConfig.adaptiveMinSamples  = std::clamp(settings.value("Settings/adaptive-min-samples", 4).toInt(), 1, rtConfig.adaptiveMaxSamples);
+    rtConfig.adaptiveTolerance   = settings.value("Settings/adaptive-tolerance", 0.02f).toFloat();
+
+    if (rtConfig.bvhWidth != 2 && rtConfig.bvhWidth != 4 && rtConfig.bvhWidth != 8) {
+        std::cerr << "Settings/bvh-width must be 2, 4 or 8, using 4 instead of " << rtConfig.bvhWidth << std::endl;
+        rtConfig.bvhWidth = 4;
+    }
 
     RayTracer raytracer{ rtConfig };
 
@@ -81,6 +103,24 @@ int main(int argc, char *argv[])
         std::cerr << "Error: failed to save image to \"" << oImagePath.toStdString() << "\"" << std::endl;
     }
 
+    // Saving the number of samples of each pixel (if a path is given), brighter pixels took more samples
+    const std::vector<int> &sampleCounts = raytracer.sampleCounts();
+    int maxSamples = sampleCounts.empty() ? 0 : *std::max_element(sampleCounts.begin(), sampleCounts.end());
+    if (!oSampleMapPath.isEmpty() && maxSamples > 0) {
+        QImage sampleMap(width, height, QImage::Format_Grayscale8);
+        for (int j = 0; j < height; j++) {
+            uchar *row = sampleMap.scanLine(j);
+            for (int i = 0; i < width; i++) {
+                row[i] = static_cast<uchar>(255 * sampleCounts[i + j * width] / maxSamples);
+            }
+        }
+        if (sampleMap.save(oSampleMapPath, "PNG")) {
+            std::cout << "Saved sample count map (" << maxSamples << " samples at most) to \"" << oSampleMapPath.toStdString() << "\"" << std::endl;
+        } else {
+            std::cerr << "Error: failed to save sample count map to \"" << oSampleMapPath.toStdString() << "\"" << std::endl;
+        }
+    }
+
     a.exit();
     return 0;
 }
@@ -1,12 +1,31 @@
 #include "meshcache.h"
 
-Mesh MeshCache::loadMeshWithCache(const std::string& meshfile) {
-    auto it = cache.find(meshfile);
-    if (it != cache.end()) {
-        return it->second;
+std::shared_ptr<const Mesh> MeshCache::loadMeshWithCache(const std::string& meshfile) {
+    std::promise<std::shared_ptr<const Mesh>> promise;
+    std::shared_future<std::shared_ptr<const Mesh>> future;
+    bool isLoader = false;
+
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto it = cache.find(meshfile);
+        if (it != cache.end()) {
+            future = it->second;
+        } else {
+            // Note: Publish the pending load first so that concurrent requests wait for it instead of loading again
+            future = promise.get_future().share();
+            cache[meshfile] = future;
+            isLoader = true;
+        }
+    }
+
+    // Load the mesh outside the lock so that other files can be looked up meanwhile
+    if (isLoader) {
+        try {
+            promise.set_value(std::make_shared<const Mesh>(loadMesh(meshfile)));
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
     }
 
-    Mesh mesh = loadMesh(meshfile);
-    cache[meshfile] = mesh;
-    return mesh;
+    return future.get();
 }
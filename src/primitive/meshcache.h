@@ -1,8 +1,15 @@
 #pragma once
 
 #include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <future>
 #include "primitive/mesh.h"
 
+// Process-wide cache of loaded meshes.
+// Meshes are immutable once loaded and handed out as shared handles, so render threads can
+// read them without copying. Lookups are thread-safe and each file is loaded only once even
+// when several threads request it at the same time.
 class MeshCache {
 public:
     static MeshCache& getInstance() {
@@ -10,7 +17,7 @@ public:
         return instance;
     }
 
-    Mesh loadMeshWithCache(const std::string& meshfile);
+    std::shared_ptr<const Mesh> loadMeshWithCache(const std::string& meshfile);
 
 private:
     MeshCache() {} // Private constructor
@@ -19,5 +26,6 @@ private:
     MeshCache(MeshCache const&) = delete;
     void operator=(MeshCache const&)  = delete;
 
-    std::unordered_map<std::string, Mesh> cache;
+    std::mutex cacheMutex;
+    std::unordered_map<std::string, std::shared_future<std::shared_ptr<const Mesh>>> cache;
 };
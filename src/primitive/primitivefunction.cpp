@@ -15,84 +15,23 @@ PrimitiveFunction::PrimitiveFunction()
 
 using TNormalTuple = std::tuple<float, glm::vec3>;
 
-std::map<QString, ImageData> imageCache;
-
-// Mesh Triangle
-TNormalTuple PrimitiveFunction::triangleIntersect(glm::vec4 p, glm::vec4 d, const Triangle& triangle) {
-    const float EPSILON = 0.0000001f;
-    glm::vec3 e1, e2, h, s, q;
-    float a, f, u, v;
-
-    e1 = triangle.v1 - triangle.v0;
-    e2 = triangle.v2 - triangle.v0;
-
-    h = glm::cross(glm::vec3(d), e2);
-    a = glm::dot(e1, h);
-
-    if (a > -EPSILON && a < EPSILON) {
-        return std::make_tuple(-1, glm::vec3(-1, -1, -1));
-    }
-
-    f = 1.0f / a;
-    s = glm::vec3(p) - triangle.v0;
-    u = f * glm::dot(s, h);
-
-    if (u < 0.0f || u > 1.0f) {
-        return std::make_tuple(-1, glm::vec3(-1, -1, -1));
-    }
-
-    q = glm::cross(s, e1);
-    v = f * glm::dot(glm::vec3(d), q);
-
-    if (v < 0.0f || u + v > 1.0f) {
-        return std::make_tuple(-1, glm::vec3(-1, -1, -1));
-    }
-
-    float t = f * glm::dot(e2, q);
-
-    if (t > EPSILON) {
-        return std::make_tuple(t, triangleNormal(triangle));
-    }
-
-    return std::make_tuple(-1, glm::vec3(-1, -1, -1));
-}
-
-
-glm::vec3 PrimitiveFunction::triangleNormal(const Triangle& triangle) {
-    glm::vec3 e1 = triangle.v1 - triangle.v0;
-    glm::vec3 e2 = triangle.v2 - triangle.v0;
-
-    glm::vec3 normal = glm::normalize(glm::cross(e1, e2));
-    return normal;
-}
-
-
 // Sphere
-TNormalTuple PrimitiveFunction::sphereIntersect(glm::vec4 p, glm::vec4 d) {
+// Note: The smaller root is the nearest intersection, it is returned even if negative, so rays starting inside
+//       (or on) the sphere do not hit it. The normal is computed with sphereNormal for the closest hit only.
+PrimitiveHit PrimitiveFunction::sphereIntersect(glm::vec4 p, glm::vec4 d) {
     // Implicit functions
     float a = d.x * d.x + d.y * d.y + d.z * d.z;
     float b = 2 * (p.x * d.x + p.y * d.y + p.z * d.z);
     float c = p.x * p.x + p.y * p.y + p.z * p.z - 0.25;
     float discriminant = calDiscriminant(a, b, c);
 
-    std::vector<TNormalTuple> intersectionTuples;
-
-    // Calculate intersections
-    std::vector<float> intersections;
-    if (discriminant == 0) {
-        float t = -b / (2*a);
-        intersectionTuples.push_back(std::make_tuple(t, sphereNormal(p, d, t)));
-    }
-    if (discriminant > 0) {
-        float t1 = (-b + sqrt(discriminant)) / (2*a);
-        float t2 = (-b - sqrt(discriminant)) / (2*a);
-        intersectionTuples.push_back(std::make_tuple(t1, sphereNormal(p, d, t1)));
-        intersectionTuples.push_back(std::make_tuple(t2, sphereNormal(p, d, t2)));
+    PrimitiveHit hit;
+    if (discriminant >= 0) {
+        hit.t = (-b - sqrt(discriminant)) / (2*a);
+        hit.surface = 0;
     }
 
-    sortTuples(intersectionTuples);
-
-    return getFirstTuple(intersectionTuples);
+    return hit;
 }
 
 TNormalTuple PrimitiveFunction::sphereIntersectInside(glm::vec4 p, glm::vec4 d) {
@@ -102,7 +41,7 @@ TNormalTuple PrimitiveFunction::sphereIntersectInside(glm::vec4 p, glm::vec4 d)
     float c = p.x * p.x + p.y * p.y + p.z * p.z - 0.25;
     float discriminant = calDiscriminant(a, b, c);
 
-    std::vector<TNormalTuple> intersectionTuples;
+    IntersectionCandidates candidates;
 
     if (discriminant < 0) {
         // This means there's something wrong. When inside the sphere, the discriminant should never be negative.
@@ -114,11 +53,9 @@ TNormalTuple PrimitiveFunction::sphereIntersectInside(glm::vec4 p, glm::vec4 d)
     float t2 = (-b - sqrt(discriminant)) / (2*a);
 
     // Since the point is inside the sphere, t2 is the point where the ray exits the sphere
-    intersectionTuples.push_back(std::make_tuple(t2, sphereNormal(p, d, t2)));
+    candidates.add(t2, sphereNormal(p, d, t2));
 
-    sortTuples(intersectionTuples);
-
-    return getFirstTuple(intersectionTuples);
+    return candidates.nearest;
 }
 
 glm::vec3 PrimitiveFunction::sphereNormal(glm::vec4 p, glm::vec4 d, float t) {
@@ -132,7 +69,7 @@ glm::vec3 PrimitiveFunction::sphereNormal(glm::vec4 p, glm::vec4 d, float t) {
     return normal;
 }
 
-glm::vec3 PrimitiveFunction::sphereTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, QString imgPath) {
+glm::vec3 PrimitiveFunction::sphereTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, const ImageData &imgData) {
     float x = p.x + t * d.x;
     float y = p.y + t * d.y;
     float z = p.z + t * d.z;
@@ -147,23 +84,6 @@ glm::vec3 PrimitiveFunction::sphereTexture(bool isFilter, glm::vec4 p, glm::vec4
 
     float v = asin(y / 0.5) / M_PI + 0.5;
 
-    // Check cache for the image
-    auto iter = imageCache.find(imgPath);
-    ImageData imgData;
-
-    if (iter == imageCache.end()) {
-        int width, height;
-        auto image = loadImage(imgPath, width, height);
-
-        imgData.data = image;
-        imgData.width = width;
-        imgData.height = height;
-
-        imageCache[imgPath] = imgData;
-    } else {
-        imgData = iter->second;
-    }
-
     int segment_u = static_cast<int>(u * repeatU);
     float u_prime = u * repeatU - segment_u;
 
@@ -186,58 +106,40 @@ glm::vec3 PrimitiveFunction::sphereTexture(bool isFilter, glm::vec4 p, glm::vec4
 
 
 // Cube
-TNormalTuple PrimitiveFunction::cubeIntersect(glm::vec4 p, glm::vec4 d) {
-    std::vector<TNormalTuple> intersectionTuples;
-
-    float t1 = (0.5 - p.x) / d.x;
-    float y = p.y + t1 * d.y;
-    float z = p.z + t1 * d.z;
-    if (y >= -0.5 && y <= 0.5 && z >= -0.5 && z <= 0.5) {
-        intersectionTuples.push_back(std::make_tuple(t1, glm::vec3 (1, 0, 0)));
-    }
-
-    float t2 = (-0.5 - p.x) / d.x;
-    y = p.y + t2 * d.y;
-    z = p.z + t2 * d.z;
-    if (y >= -0.5 && y <= 0.5 && z >= -0.5 && z <= 0.5) {
-        intersectionTuples.push_back(std::make_tuple(t2, glm::vec3 (-1, 0, 0)));
-    }
-
-    float t3 = (0.5 - p.y) / d.y;
-    float x = p.x + t3 * d.x;
-    z = p.z + t3 * d.z;
-    if (x >= -0.5 && x <= 0.5 && z >= -0.5 && z <= 0.5) {
-        intersectionTuples.push_back(std::make_tuple(t3, glm::vec3 (0, 1, 0)));
-    }
-
-    float t4 = (-0.5 - p.y) / d.y;
-    x = p.x + t4 * d.x;
-    z = p.z + t4 * d.z;
-    if (x >= -0.5 && x <= 0.5 && z >= -0.5 && z <= 0.5) {
-        intersectionTuples.push_back(std::make_tuple(t4, glm::vec3 (0, -1, 0)));
-    }
-
-    float t5 = (0.5 - p.z) / d.z;
-    x = p.x + t5 * d.x;
-    y = p.y + t5 * d.y;
-    if (x >= -0.5 && x <= 0.5 && y >= -0.5 && y <= 0.5) {
-        intersectionTuples.push_back(std::make_tuple(t5, glm::vec3 (0, 0, 1)));
-    }
-
-    float t6 = (-0.5 - p.z) / d.z;
-    x = p.x + t6 * d.x;
-    y = p.y + t6 * d.y;
-    if (x >= -0.5 && x <= 0.5 && y >= -0.5 && y <= 0.5) {
-        intersectionTuples.push_back(std::make_tuple(t6, glm::vec3 (0, 0, -1)));
-    }
+// Note: Along each axis only the face that faces the ray can be where the ray enters the cube, so 3 of the 6 faces
+//       are tested and the nearest valid one is kept. The hit surface is the face index used by cubeNormal.
+PrimitiveHit PrimitiveFunction::cubeIntersect(glm::vec4 p, glm::vec4 d) {
+    PrimitiveHit hit;
+
+    // Test the face of an axis that faces the ray, u and v are the other two axes
+    auto testFace = [&](int axis, int u, int v) {
+        // The positive face faces a ray going in the negative direction
+        bool isPositiveFace = d[axis] < 0;
+        float t = ((isPositiveFace ? 0.5 : -0.5) - p[axis]) / d[axis];
+        float pu = p[u] + t * d[u];
+        float pv = p[v] + t * d[v];
+        bool isInsideFace = pu >= -0.5 && pu <= 0.5 && pv >= -0.5 && pv <= 0.5;
+        if (isInsideFace && (hit.surface < 0 || t < hit.t)) {
+            hit.t = t;
+            hit.surface = 2 * axis + (isPositiveFace ? 0 : 1);
+        }
+    };
+    testFace(0, 1, 2);
+    testFace(1, 0, 2);
+    testFace(2, 0, 1);
 
-    sortTuples(intersectionTuples);
+    return hit;
+}
 
-    return getFirstTuple(intersectionTuples);
+// Normal of a cube face in the order +x, -x, +y, -y, +z, -z
+glm::vec3 PrimitiveFunction::cubeNormal(int face) {
+    glm::vec3 normal(0);
+    normal[face / 2] = face % 2 == 0 ? 1 : -1;
+    return normal;
 }
 
 TNormalTuple PrimitiveFunction::cubeIntersectFromInside(glm::vec4 p, glm::vec4 d) {
-    std::vector<TNormalTuple> intersectionTuples;
+    IntersectionCandidates candidates;
 
     // Check each face for intersections:
     for (int i = 0; i < 3; ++i) {
@@ -256,13 +158,11 @@ TNormalTuple PrimitiveFunction::cubeIntersectFromInside(glm::vec4 p, glm::vec4 d
 
         // Now, positive_face is your exit point.
         if (checkInsideCube(positive_face, p, d)) {
-            intersectionTuples.push_back(std::make_tuple(positive_face, pos_normal));
+            candidates.add(positive_face, pos_normal);
         }
     }
 
-    sortTuples(intersectionTuples);
-
-    return getFirstTuple(intersectionTuples);
+    return candidates.nearest;
 }
 
 bool PrimitiveFunction::checkInsideCube(float t, glm::vec4 p, glm::vec4 d) {
@@ -278,7 +178,7 @@ bool PrimitiveFunction::checkInsideCube(float t, glm::vec4 p, glm::vec4 d) {
     }
 }
 
-glm::vec3 PrimitiveFunction::cubeTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, QString imgPath) {
+glm::vec3 PrimitiveFunction::cubeTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, const ImageData &imgData) {
     const float epsilon = 1e-5f;  // Epsilon for floating point comparisons
 
     float x = p.x + t * d.x;
@@ -314,23 +214,6 @@ glm::vec3 PrimitiveFunction::cubeTexture(bool isFilter, glm::vec4 p, glm::vec4 d
         v = (y + 0.5);
     }
 
-    // Check cache for the image
-    auto iter = imageCache.find(imgPath);
-    ImageData imgData;
-
-    if (iter == imageCache.end()) {
-        int width, height;
-        auto image = loadImage(imgPath, width, height);
-
-        imgData.data = image;
-        imgData.width = width;
-        imgData.height = height;
-
-        imageCache[imgPath] = imgData;
-    } else {
-        imgData = iter->second;
-    }
-
     int segment_u = static_cast<int>(u * repeatU);
     float u_prime = u * repeatU - segment_u;
 
@@ -353,53 +236,38 @@ glm::vec3 PrimitiveFunction::cubeTexture(bool isFilter, glm::vec4 p, glm::vec4 d
 
 
 //Cylinder
-TNormalTuple PrimitiveFunction::cylinderIntersect(glm::vec4 p, glm::vec4 d) {
+// Note: Only the smaller root of the side and the cap facing the ray can be where the ray enters the cylinder,
+//       so the farther root and cap are not tested. The hit surface is 0 for the side, 1 for the top and 2 for the bottom cap.
+PrimitiveHit PrimitiveFunction::cylinderIntersect(glm::vec4 p, glm::vec4 d) {
     // Implicit functions for infinite cylinder
     float a = d.x * d.x + d.z * d.z;
     float b = 2 * (p.x * d.x + p.z * d.z);
     float c = p.x * p.x + p.z * p.z - 0.25;
     float discriminant = calDiscriminant(a, b, c);
 
-    std::vector<TNormalTuple> intersectionTuples;
+    PrimitiveHit hit;
 
-    // Calculate intersections with infinite cylinder
-    if (discriminant == 0) {
-        float t = -b / (2*a);
+    // Calculate intersection with the side
+    if (discriminant >= 0) {
+        float t = (-b - sqrt(discriminant)) / (2*a);
         float y = p.y + t * d.y;
         if (y >= -0.5 && y <= 0.5) {
-            intersectionTuples.push_back(std::make_tuple(t, cylinderRoundNormal(p, d, t)));
-        }
-    }
-    if (discriminant > 0) {
-        float t1 = (-b + sqrt(discriminant)) / (2*a);
-        float t2 = (-b - sqrt(discriminant)) / (2*a);
-        float y1 = p.y + t1 * d.y;
-        if (y1 >= -0.5 && y1 <= 0.5) {
-            intersectionTuples.push_back(std::make_tuple(t1, cylinderRoundNormal(p, d, t1)));
+            hit.t = t;
+            hit.surface = 0;
         }
-        float y2 = p.y + t2 * d.y;
-        if (y2 >= -0.5 && y2 <= 0.5) {
-            intersectionTuples.push_back(std::make_tuple(t2, cylinderRoundNormal(p, d, t2)));
-        }
-    }
-
-    float t3 = (0.5 - p.y) / d.y;
-    float x3 = p.x + t3 * d.x;
-    float z3 = p.z + t3 * d.z;
-    if (x3 * x3 + z3 * z3 <= 0.25) {
-        intersectionTuples.push_back(std::make_tuple(t3, glm::vec3 (0, 1, 0)));
     }
 
-    float t4 = (-0.5 - p.y) / d.y;
-    float x4 = p.x + t4 * d.x;
-    float z4 = p.z + t4 * d.z;
-    if (x4 * x4 + z4 * z4 <= 0.25) {
-        intersectionTuples.push_back(std::make_tuple(t4, glm::vec3 (0, -1, 0)));
+    // Calculate intersection with the cap facing the ray
+    bool isTopCap = d.y < 0;
+    float tCap = ((isTopCap ? 0.5 : -0.5) - p.y) / d.y;
+    float x = p.x + tCap * d.x;
+    float z = p.z + tCap * d.z;
+    if (x * x + z * z <= 0.25 && (hit.surface < 0 || tCap < hit.t)) {
+        hit.t = tCap;
+        hit.surface = isTopCap ? 1 : 2;
     }
 
-    sortTuples(intersectionTuples);
-
-    return getFirstTuple(intersectionTuples);
+    return hit;
 }
 
 TNormalTuple PrimitiveFunction::cylinderIntersectInside(glm::vec4 p, glm::vec4 d) {
@@ -407,20 +275,20 @@ TNormalTuple PrimitiveFunction::cylinderIntersectInside(glm::vec4 p, glm::vec4 d
     float b = 2 * p.x * d.x + 2 * p.z * d.z;
     float c = p.x * p.x + p.z * p.z - 0.25;
 
-    std::vector<TNormalTuple> intersectionTuples;
+    IntersectionCandidates candidates;
 
     float discriminant = calDiscriminant(a, b, c);
     if (discriminant >= 0) {
         float t1 = (-b + sqrt(discriminant)) / (2*a);
         float y1 = p.y + t1 * d.y;
         if (y1 >= -0.5 && y1 <= 0.5) {
-            intersectionTuples.push_back(std::make_tuple(t1, glm::vec3(0, 1, 0)));
+            candidates.add(t1, glm::vec3(0, 1, 0));
         }
 
         float t2 = (-b - sqrt(discriminant)) / (2*a);
         float y2 = p.y + t2 * d.y;
         if (y2 >= -0.5 && y2 <= 0.5) {
-            intersectionTuples.push_back(std::make_tuple(t2, glm::vec3(0, 1, 0)));
+            candidates.add(t2, glm::vec3(0, 1, 0));
         }
     }
 
@@ -428,19 +296,17 @@ TNormalTuple PrimitiveFunction::cylinderIntersectInside(glm::vec4 p, glm::vec4 d
     float x4 = p.x + t4 * d.x;
     float z4 = p.z + t4 * d.z;
     if (x4 * x4 + z4 * z4 <= 0.25) {
-        intersectionTuples.push_back(std::make_tuple(t4, glm::vec3 (0, -1, 0)));
+        candidates.add(t4, glm::vec3 (0, -1, 0));
     }
 
     float t3 = (0.5 - p.y) / d.y;
     float x3 = p.x + t3 * d.x;
     float z3 = p.z + t3 * d.z;
     if (x3 * x3 + z3 * z3 <= 0.25) {
-        intersectionTuples.push_back(std::make_tuple(t3, glm::vec3 (0, 1, 0)));
+        candidates.add(t3, glm::vec3 (0, 1, 0));
     }
 
-    sortTuples(intersectionTuples);
-
-    return getLastTuple(intersectionTuples);  // farthest intersection.
+    return candidates.farthest;  // farthest intersection.
 }
 
 
@@ -455,7 +321,14 @@ glm::vec3 PrimitiveFunction::cylinderRoundNormal(glm::vec4 p, glm::vec4 d, float
     return normal;
 }
 
-glm::vec3 PrimitiveFunction::cylinderTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, QString imgPath) {
+glm::vec3 PrimitiveFunction::cylinderNormal(glm::vec4 p, glm::vec4 d, const PrimitiveHit &hit) {
+    if (hit.surface == 0) {
+        return cylinderRoundNormal(p, d, hit.t);
+    }
+    return glm::vec3(0, hit.surface == 1 ? 1 : -1, 0);
+}
+
+glm::vec3 PrimitiveFunction::cylinderTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, const ImageData &imgData) {
     float x = p.x + t * d.x;
     float y = p.y + t * d.y;
     float z = p.z + t * d.z;
@@ -485,23 +358,6 @@ glm::vec3 PrimitiveFunction::cylinderTexture(bool isFilter, glm::vec4 p, glm::ve
         v = y + 0.5;  // Maps [-1,1] to [0,1]
     }
 
-    // Check cache for the image
-    auto iter = imageCache.find(imgPath);
-    ImageData imgData;
-
-    if (iter == imageCache.end()) {
-        int width, height;
-        auto image = loadImage(imgPath, width, height);
-
-        imgData.data = image;
-        imgData.width = width;
-        imgData.height = height;
-
-        imageCache[imgPath] = imgData;
-    } else {
-        imgData = iter->second;
-    }
-
     int segment_u = static_cast<int>(u * repeatU);
     float u_prime = u * repeatU - segment_u;
 
@@ -523,46 +379,43 @@ glm::vec3 PrimitiveFunction::cylinderTexture(bool isFilter, glm::vec4 p, glm::ve
 }
 
 // Cone
-TNormalTuple PrimitiveFunction::coneIntersect(glm::vec4 p, glm::vec4 d) {
+// Note: Both roots are tested since the implicit function describes a double cone and the nearer root may be on the
+//       other half. The hit surface is 0 for the side and 1 for the bottom cap.
+PrimitiveHit PrimitiveFunction::coneIntersect(glm::vec4 p, glm::vec4 d) {
     // Implicit functions
     float a = d.x * d.x + d.z * d.z - 0.25 * d.y * d.y;
     float b = 2 * p.x * d.x + 2 * p.z * d.z - 0.5 * p.y * d.y + 0.25 * d.y;
     float c = p.x * p.x + p.z * p.z - 0.25 * p.y * p.y + 0.25 * p.y - 0.0625;
     float discriminant = calDiscriminant(a, b, c);
 
-    std::vector<TNormalTuple> intersectionTuples;
+    PrimitiveHit hit;
 
-    // Calculate intersections with infinite cylinder
-    if (discriminant == 0) {
-        float t = -b / (2*a);
-        float y = p.y + t * d.y;
-        if (y >= -0.5 && y <= 0.5) {
-            intersectionTuples.push_back(std::make_tuple(t, coneTopNormal(p, d, t)));
-        }
-    }
-    if (discriminant > 0) {
+    // Calculate intersections with the side
+    if (discriminant >= 0) {
         float t1 = (-b + sqrt(discriminant)) / (2*a);
         float t2 = (-b - sqrt(discriminant)) / (2*a);
         float y1 = p.y + t1 * d.y;
         if (y1 >= -0.5 && y1 <= 0.5) {
-            intersectionTuples.push_back(std::make_tuple(t1, coneTopNormal(p, d, t1)));
+            hit.t = t1;
+            hit.surface = 0;
         }
         float y2 = p.y + t2 * d.y;
-        if (y2 >= -0.5 && y2 <= 0.5) {
-            intersectionTuples.push_back(std::make_tuple(t2, coneTopNormal(p, d, t2)));
+        if (y2 >= -0.5 && y2 <= 0.5 && (hit.surface < 0 || t2 < hit.t)) {
+            hit.t = t2;
+            hit.surface = 0;
         }
     }
 
+    // Calculate intersection with the bottom cap
     float t3 = (-0.5 - p.y) / d.y;
     float x3 = p.x + t3 * d.x;
     float z3 = p.z + t3 * d.z;
-    if (x3 * x3 + z3 * z3 <= 0.25) {
-        intersectionTuples.push_back(std::make_tuple(t3, glm::vec3 (0, -1, 0)));
+    if (x3 * x3 + z3 * z3 <= 0.25 && (hit.surface < 0 || t3 < hit.t)) {
+        hit.t = t3;
+        hit.surface = 1;
     }
 
-    sortTuples(intersectionTuples);
-
-    return getFirstTuple(intersectionTuples);
+    return hit;
 }
 
 TNormalTuple PrimitiveFunction::coneIntersectInside(glm::vec4 p, glm::vec4 d) {
@@ -570,26 +423,26 @@ TNormalTuple PrimitiveFunction::coneIntersectInside(glm::vec4 p, glm::vec4 d) {
     float b = 2 * p.x * d.x + 2 * p.z * d.z - 0.5 * p.y * d.y + 0.25 * d.y;
     float c = p.x * p.x + p.z * p.z - 0.25 * p.y * p.y + 0.25 * p.y - 0.0625;
 
-    std::vector<TNormalTuple> intersectionTuples;
+    IntersectionCandidates candidates;
 
     float discriminant = calDiscriminant(a, b, c);
     if (discriminant == 0) {
         float t = -b / (2*a);
         float y = p.y + t * d.y;
         if (y >= -0.5 && y <= 0.5) {
-            intersectionTuples.push_back(std::make_tuple(t, coneTopNormal(p, d, t)));
+            candidates.add(t, coneTopNormal(p, d, t));
         }
     }
     if (discriminant > 0) {
         float t1 = (-b + sqrt(discriminant)) / (2*a);
         float y1 = p.y + t1 * d.y;
         if (y1 >= -0.5 && y1 <= 0.5) {
-            intersectionTuples.push_back(std::make_tuple(t1, coneTopNormal(p, d, t1)));
+            candidates.add(t1, coneTopNormal(p, d, t1));
         }
         float t2 = (-b - sqrt(discriminant)) / (2*a);
         float y2 = p.y + t2 * d.y;
         if (y2 >= -0.5 && y2 <= 0.5) {
-            intersectionTuples.push_back(std::make_tuple(t2, coneTopNormal(p, d, t2)));
+            candidates.add(t2, coneTopNormal(p, d, t2));
         }
     }
 
@@ -597,12 +450,10 @@ TNormalTuple PrimitiveFunction::coneIntersectInside(glm::vec4 p, glm::vec4 d) {
     float x3 = p.x + t3 * d.x;
     float z3 = p.z + t3 * d.z;
     if (x3 * x3 + z3 * z3 <= 0.25) {
-        intersectionTuples.push_back(std::make_tuple(t3, glm::vec3 (0, -1, 0)));
+        candidates.add(t3, glm::vec3 (0, -1, 0));
     }
 
-    sortTuples(intersectionTuples);
-
-    return getLastTuple(intersectionTuples);  // farthest intersection.
+    return candidates.farthest;  // farthest intersection.
 }
 
 
@@ -617,7 +468,14 @@ glm::vec3 PrimitiveFunction::coneTopNormal(glm::vec4 p, glm::vec4 d, float t) {
     return normal;
 }
 
-glm::vec3 PrimitiveFunction::coneTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, QString imgPath) {
+glm::vec3 PrimitiveFunction::coneNormal(glm::vec4 p, glm::vec4 d, const PrimitiveHit &hit) {
+    if (hit.surface == 0) {
+        return coneTopNormal(p, d, hit.t);
+    }
+    return glm::vec3(0, -1, 0);
+}
+
+glm::vec3 PrimitiveFunction::coneTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, const ImageData &imgData) {
     // Calculate intersection point on the cone
     float x = p.x + t * d.x;
     float y = p.y + t * d.y;
@@ -644,23 +502,6 @@ glm::vec3 PrimitiveFunction::coneTexture(bool isFilter, glm::vec4 p, glm::vec4 d
         v = y + 0.5;
     }
 
-    // Check cache for the image
-    auto iter = imageCache.find(imgPath);
-    ImageData imgData;
-
-    if (iter == imageCache.end()) {
-        int width, height;
-        auto image = loadImage(imgPath, width, height);
-
-        imgData.data = image;
-        imgData.width = width;
-        imgData.height = height;
-
-        imageCache[imgPath] = imgData;
-    } else {
-        imgData = iter->second;
-    }
-
     int segment_u = static_cast<int>(u * repeatU);
     float u_prime = u * repeatU - segment_u;
 
@@ -682,37 +523,9 @@ glm::vec3 PrimitiveFunction::coneTexture(bool isFilter, glm::vec4 p, glm::vec4 d
 }
 
 
-/******************************* I/O functions *******************************/
-std::vector<RGBA> PrimitiveFunction::loadImage(const QString &filePath, int &width, int &height) {
-    QImage myImage;
-    if (!myImage.load(filePath)) {
-        std::cerr << "Failed to load in image" << std::endl;
-        return {};
-    }
-
-    myImage = myImage.convertToFormat(QImage::Format_RGBX8888);
-    QByteArray arr = QByteArray::fromRawData((const char*) myImage.bits(), myImage.sizeInBytes());
-
-    width = myImage.width();
-    height = myImage.height();
-
-    std::vector<RGBA> image;
-    image.reserve(width * height);
-    for (int i = 0; i < arr.size() / 4; i++){
-        image.push_back(RGBA{
-            (std::uint8_t) arr[4*i],
-            (std::uint8_t) arr[4*i+1],
-            (std::uint8_t) arr[4*i+2],
-            (std::uint8_t) arr[4*i+3]
-        });
-    }
-
-    return image;
-}
-
 /******************************* Helper functions *******************************/
 // Bilinear filtering
-glm::vec3 PrimitiveFunction::bilinearFiltering(float u_prime, float v_prime, ImageData imgData) {
+glm::vec3 PrimitiveFunction::bilinearFiltering(float u_prime, float v_prime, const ImageData &imgData) {
     float x = u_prime * imgData.width;
     float y = imgData.height - 1 - v_prime * imgData.height;
 
@@ -747,7 +560,7 @@ float PrimitiveFunction::bilinearInterpolate(float A, float B, float alpha) {
 }
 
 // Bicubic filtering
-glm::vec3 PrimitiveFunction::biCubicFiltering(float u_prime, float v_prime, ImageData imgData) {
+glm::vec3 PrimitiveFunction::biCubicFiltering(float u_prime, float v_prime, const ImageData &imgData) {
     float x = u_prime * imgData.width;
     float y = imgData.height - 1 - v_prime * imgData.height;
 
@@ -793,57 +606,22 @@ glm::vec3 PrimitiveFunction::cubicInterpolate(const glm::vec3& p0, const glm::ve
 
 
 // Repeats the pixel on the edge of the image such that A,B,C,D looks like ...A,A,A,B,C,D,D,D...
-RGBA PrimitiveFunction::getPixelRepeated(std::vector<RGBA> &data, int width, int height, int x, int y) {
+RGBA PrimitiveFunction::getPixelRepeated(const std::vector<RGBA> &data, int width, int height, int x, int y) {
     int newX = (x < 0) ? 0 : std::min(x, width  - 1);
     int newY = (y < 0) ? 0 : std::min(y, height - 1);
     return data[width * newY + newX];
 }
 
-// Function to sort the tuples by the float values
-void PrimitiveFunction::sortTuples(std::vector<TNormalTuple>& tupleList) {
-    std::sort(tupleList.begin(), tupleList.end(),
-              [](const TNormalTuple &a, const TNormalTuple &b) {
-                  return std::get<0>(a) < std::get<0>(b);
-              });
-}
-
-// Function to get the normal from the tuple with the smallest t
-glm::vec3 PrimitiveFunction::getNormalFromSmallestT(const std::vector<TNormalTuple>& tupleList) {
-    if(!tupleList.empty()) {
-        return std::get<1>(tupleList.front());
+// Add a candidate intersection
+// Note: Of candidates with equal t, the nearest keeps the first added and the farthest the last added one
+void IntersectionCandidates::add(float t, const glm::vec3 &normal) {
+    if (count == 0 || t < std::get<0>(nearest)) {
+        nearest = std::make_tuple(t, normal);
     }
-    // Return a default value if the list is empty
-    return glm::vec3(-1);
-}
-
-TNormalTuple PrimitiveFunction::getFirstTuple(const std::vector<TNormalTuple>& tupleList) {
-    if(!tupleList.empty()) {
-        return tupleList.front();
+    if (count == 0 || t >= std::get<0>(farthest)) {
+        farthest = std::make_tuple(t, normal);
     }
-    // Return a default value if the list is empty
-    return std::make_tuple(-1, glm::vec3(-1));
-}
-
-TNormalTuple PrimitiveFunction::getLastTuple(const std::vector<TNormalTuple>& intersectionTuples) {
-    if (intersectionTuples.empty()) {
-        return std::make_tuple(INFINITY, glm::vec3(0, 0, 0));
-    }
-    return intersectionTuples.back();
-}
-
-
-float PrimitiveFunction::calNearestIntersection(std::vector<float> intersections) {
-    // Find out the smallest non-negative value
-    float smallestNonNegative = -1;
-    for (float value : intersections) {
-        if (value >= 0) {
-            if (smallestNonNegative == -1 || value < smallestNonNegative) {
-                smallestNonNegative = value;
-            }
-        }
-    }
-
-    return smallestNonNegative;
+    count++;
 }
 
 float PrimitiveFunction::calDiscriminant(float a, float b, float c) {
@@ -2,21 +2,31 @@
 
 #include <glm/glm.hpp>
 #include <vector>
+#include <tuple>
+#include <cmath>
 #include <iostream>
 #include <QObject>
-#include <QImage>
 #include "utils/rgba.h"
+#include "primitive/texturecache.h"
 
 using TNormalTuple = std::tuple<float, glm::vec3>;
 
-struct Triangle {
-    glm::vec3 v0, v1, v2; // vertices
+// Candidate intersections of a ray with a primitive
+// Note: Only the nearest and farthest candidates are kept, so no list needs to be allocated and sorted per ray
+struct IntersectionCandidates {
+    TNormalTuple nearest = std::make_tuple(-1, glm::vec3(-1));      // Returned if there is no candidate
+    TNormalTuple farthest = std::make_tuple(INFINITY, glm::vec3(0)); // Returned if there is no candidate
+    int count = 0;
+
+    void add(float t, const glm::vec3 &normal);
 };
 
-struct ImageData {
-    std::vector<RGBA> data;
-    int width;
-    int height;
+// Nearest intersection of a ray with a primitive in object space
+// Note: Intersectors only find the distance and the surface that is hit, the normal is computed afterwards
+//       for the closest hit of the ray only.
+struct PrimitiveHit {
+    float t = -1;      // Distance along the ray, -1 if there is no hit
+    int surface = -1;  // Surface of the primitive that is hit, see the normal functions
 };
 
 class PrimitiveFunction
@@ -24,13 +34,10 @@ class PrimitiveFunction
 public:
     PrimitiveFunction();
 
-    TNormalTuple triangleIntersect(glm::vec4 p, glm::vec4 d, const Triangle& triangle);
-    glm::vec3 triangleNormal(const Triangle& triangle);
-
-    TNormalTuple cubeIntersect(glm::vec4 p, glm::vec4 d);
-    TNormalTuple sphereIntersect(glm::vec4 p, glm::vec4 d);
-    TNormalTuple cylinderIntersect(glm::vec4 p, glm::vec4 d);
-    TNormalTuple coneIntersect(glm::vec4 p, glm::vec4 d);
+    PrimitiveHit cubeIntersect(glm::vec4 p, glm::vec4 d);
+    PrimitiveHit sphereIntersect(glm::vec4 p, glm::vec4 d);
+    PrimitiveHit cylinderIntersect(glm::vec4 p, glm::vec4 d);
+    PrimitiveHit coneIntersect(glm::vec4 p, glm::vec4 d);
 
     TNormalTuple sphereIntersectInside(glm::vec4 p, glm::vec4 d);
     TNormalTuple cubeIntersectFromInside(glm::vec4 p, glm::vec4 d);
@@ -38,29 +45,24 @@ public:
     TNormalTuple coneIntersectInside(glm::vec4 p, glm::vec4 d);
 
     glm::vec3 sphereNormal(glm::vec4 p, glm::vec4 d, float t);
-    glm::vec3 cubeNormal(glm::vec4 p, glm::vec4 d, float t);
+    glm::vec3 cubeNormal(int face);
+    glm::vec3 cylinderNormal(glm::vec4 p, glm::vec4 d, const PrimitiveHit &hit);
     glm::vec3 cylinderRoundNormal(glm::vec4 p, glm::vec4 d, float t);
+    glm::vec3 coneNormal(glm::vec4 p, glm::vec4 d, const PrimitiveHit &hit);
     glm::vec3 coneTopNormal(glm::vec4 p, glm::vec4 d, float t);
 
-    glm::vec3 sphereTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, QString imgPath);
-    glm::vec3 cubeTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, QString imgPath);
-    glm::vec3 cylinderTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, QString imgPath);
-    glm::vec3 coneTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, QString imgPath);
-
-    std::vector<RGBA> loadImage(const QString &filePath, int &width, int &height);
+    glm::vec3 sphereTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, const ImageData &imgData);
+    glm::vec3 cubeTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, const ImageData &imgData);
+    glm::vec3 cylinderTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, const ImageData &imgData);
+    glm::vec3 coneTexture(bool isFilter, glm::vec4 p, glm::vec4 d, float t, float repeatU, float repeatV, const ImageData &imgData);
 
-    glm::vec3 bilinearFiltering(float u_prime, float v_prime, ImageData imgData);
+    glm::vec3 bilinearFiltering(float u_prime, float v_prime, const ImageData &imgData);
     float bilinearInterpolate(float A, float B, float alpha);
-    glm::vec3 biCubicFiltering(float u_prime, float v_prime, ImageData imgData);
+    glm::vec3 biCubicFiltering(float u_prime, float v_prime, const ImageData &imgData);
     glm::vec3 cubicInterpolate(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, float alpha);
 
-    RGBA getPixelRepeated(std::vector<RGBA> &data, int width, int height, int x, int y);
+    RGBA getPixelRepeated(const std::vector<RGBA> &data, int width, int height, int x, int y);
 
-    void sortTuples(std::vector<TNormalTuple>& tupleList);
-    glm::vec3 getNormalFromSmallestT(const std::vector<TNormalTuple>& tupleList);
-    TNormalTuple getFirstTuple(const std::vector<TNormalTuple>& tupleList);
-    TNormalTuple getLastTuple(const std::vector<TNormalTuple>& intersectionTuples);
     bool checkInsideCube(float t, glm::vec4 p, glm::vec4 d);
-    float calNearestIntersection(std::vector<float> intersections);
     float calDiscriminant(float a, float b, float c);
 };
@@ -0,0 +1,57 @@
+#include "texturecache.h"
+
+#include <QImage>
+#include <QString>
+#include <iostream>
+
+// Note: error handling returns nullptr for an invalid image file
+std::shared_ptr<const ImageData> loadTexture(const std::string& filePath) {
+    QImage myImage;
+    if (!myImage.load(QString::fromStdString(filePath))) {
+        std::cerr << "Failed to load in image" << std::endl;
+        return nullptr;
+    }
+
+    myImage = myImage.convertToFormat(QImage::Format_RGBX8888);
+    const std::uint8_t* bits = myImage.bits();
+
+    auto image = std::make_shared<ImageData>();
+    image->width = myImage.width();
+    image->height = myImage.height();
+    image->data.reserve(image->width * image->height);
+    for (int i = 0; i < myImage.sizeInBytes() / 4; i++){
+        image->data.push_back(RGBA{bits[4*i], bits[4*i+1], bits[4*i+2], bits[4*i+3]});
+    }
+
+    return image;
+}
+
+std::shared_ptr<const ImageData> TextureCache::loadTextureWithCache(const std::string& filename) {
+    std::promise<std::shared_ptr<const ImageData>> promise;
+    std::shared_future<std::shared_ptr<const ImageData>> future;
+    bool isLoader = false;
+
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto it = cache.find(filename);
+        if (it != cache.end()) {
+            future = it->second;
+        } else {
+            // Note: Publish the pending load first so that concurrent requests wait for it instead of loading again
+            future = promise.get_future().share();
+            cache[filename] = future;
+            isLoader = true;
+        }
+    }
+
+    // Load the image outside the lock so that other files can be looked up meanwhile
+    if (isLoader) {
+        try {
+            promise.set_value(loadTexture(filename));
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    }
+
+    return future.get();
+}
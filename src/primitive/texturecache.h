@@ -0,0 +1,41 @@
+#pragma once
+
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <string>
+#include <vector>
+#include "utils/rgba.h"
+
+struct ImageData {
+    std::vector<RGBA> data;
+    int width;
+    int height;
+};
+
+// Process-wide cache of loaded texture images.
+// Textures are loaded once while setting up the scene and handed out as shared read-only handles
+// that are stored on the material, so render threads read texels without locking or copying.
+class TextureCache {
+public:
+    static TextureCache& getInstance() {
+        static TextureCache instance;
+        return instance;
+    }
+
+    // Returns nullptr if the image can not be loaded
+    std::shared_ptr<const ImageData> loadTextureWithCache(const std::string& filename);
+
+private:
+    TextureCache() {} // Private constructor
+
+    // Delete copy and assignment operators
+    TextureCache(TextureCache const&) = delete;
+    void operator=(TextureCache const&)  = delete;
+
+    std::mutex cacheMutex;
+    std::unordered_map<std::string, std::shared_future<std::shared_ptr<const ImageData>>> cache;
+};
+
+std::shared_ptr<const ImageData> loadTexture(const std::string& filePath);
@@ -4,9 +4,8 @@
 #include <QThreadPool>
 #include <QFuture>
 #include <QtConcurrent>
-
-QQueue<QPair<int, int>> taskQueue;
-QMutex taskQueueMutex;
+#include <atomic>
+#include <unordered_map>
 
 RayTracer::RayTracer(Config config) :
     m_config(config)
@@ -14,81 +13,113 @@ RayTracer::RayTracer(Config config) :
 
 using TNormalTuple = std::tuple<float, glm::vec3>;
 
+// Maximum distance of camera and secondary rays, which bounds the nearest intersection
+static const float MAX_RAY_DISTANCE = 1000;
+
 // Main function to be called for render
 void RayTracer::render(RGBA *imageData, RayTraceScene &scene) {
-    // Create bvh for each mesh in the shape list
+    BVHBuildOptions bvhOptions;
+    bvhOptions.splitMethod = m_config.enableSAH ? BVHSplitMethod::SAH : BVHSplitMethod::Median;
+    bvhOptions.maxLeafSize = m_config.bvhMaxLeafSize;
+    bvhOptions.width = m_config.bvhWidth;
+
+    // Create bvh for each unique mesh in the shape list
+    // Note: The triangle BVH is built in object space, so all instances of a mesh file share one BVH (bottom level)
+    //       and only their CTMs differ. The scene BVH over the instances' world bounds acts as the top level.
+    std::unordered_map<std::string, std::shared_ptr<const BVH>> meshBVHs;
     for (auto &shape : scene.sceneMetaData.shapes) {
         if (shape.primitive.type == PrimitiveType::PRIMITIVE_MESH) {
-            Mesh mesh = MeshCache::getInstance().loadMeshWithCache(shape.primitive.meshfile);
-            shape.triangleBVH = std::make_shared<BVH>(mesh);
+            shape.mesh = MeshCache::getInstance().loadMeshWithCache(shape.primitive.meshfile);
+            std::shared_ptr<const BVH> &triangleBVH = meshBVHs[shape.primitive.meshfile];
+            if (!triangleBVH) {
+                triangleBVH = std::make_shared<const BVH>(*shape.mesh, bvhOptions);
+            }
+            shape.triangleBVH = triangleBVH;
+        }
+    }
+
+    // Load the texture of each shape once before rendering
+    if (m_config.enableTextureMap) {
+        for (auto &shape : scene.sceneMetaData.shapes) {
+            SceneFileMap &textureMap = shape.primitive.material.textureMap;
+            if (textureMap.isUsed) {
+                textureMap.image = TextureCache::getInstance().loadTextureWithCache(textureMap.filename);
+            }
         }
     }
 
     // Build BVH for shapes (if accelaration activated)
     if (m_config.enableAcceleration) {
         std::vector<RenderShapeData> sceneShapes = scene.sceneMetaData.shapes;
-        m_bvh = new BVH(sceneShapes);
+        m_bvh = new BVH(sceneShapes, bvhOptions);
     }
 
+    // Paths that do not sample adaptively trace one sample per pixel
+    m_sampleCounts.assign(scene.width() * scene.height(), 1);
+
+    // Select the render functions compiled for the enabled features
+    RenderBlockFunction renderBlockFunction = selectRenderBlock(renderFeatures(), std::make_index_sequence<FEATURE_COMBINATIONS>());
+
     // Render image by dynamically render blocks or render the whole image
     if (m_config.enableParallelism) {
-        // Dynamically determine the block size based on the number of processor cores
-        const int numCores = QThread::idealThreadCount();
-        const int BLOCK_SIZE = std::max(scene.width() / numCores, 32);
-
-        // Declared taskQueue
-        QQueue<QPair<QPair<int, int>, QPair<int, int>>> taskQueue;
+        // Number of workers defaults to the number of processor cores
+        const int numThreads = m_config.numThreads > 0 ? m_config.numThreads : QThread::idealThreadCount();
+        const int BLOCK_SIZE = m_config.blockSize;
 
-        // Populate the global task queue with tasks of block size
+        // Populate the task list with tasks of block size
+        std::vector<RenderBlock> blocks;
         for (int y = 0; y < scene.height(); y += BLOCK_SIZE) {
             for (int x = 0; x < scene.width(); x += BLOCK_SIZE) {
-                //  Note: Protect code (setting sizes and create queues) in this block by the mutex
                 int endX = std::min(x + BLOCK_SIZE, scene.width());
                 int endY = std::min(y + BLOCK_SIZE, scene.height());
-
-                QPair<int, int> start = qMakePair(x, y);
-                QPair<int, int> end = qMakePair(endX, endY);
-                QPair<QPair<int, int>, QPair<int, int>> block = qMakePair(start, end);
-
-                // Center prioritization
-                int centerY = scene.height() / 2;
-                int centerX = scene.width() / 2;
-
-                if (y <= centerY && centerY < endY && x <= centerX && centerX < endX) {
-                    QMutexLocker locker(&taskQueueMutex);
-                    taskQueue.prepend(block);
-                } else {
-                    QMutexLocker locker(&taskQueueMutex);
-                    taskQueue.enqueue(block);
-                }
-                // Note: Once the block ends, locker's destructor is called, and the mutex is unlocked.
+                blocks.push_back({x, y, endX, endY});
             }
         }
 
+        // Center prioritization
+        // Note: Blocks closer to the image center are rendered first
+        if (m_config.enableCenterFirst) {
+            float centerX = scene.width() / 2.0f;
+            float centerY = scene.height() / 2.0f;
+            auto distanceToCenter = [centerX, centerY](const RenderBlock &block) {
+                float dx = (block.startX + block.endX) / 2.0f - centerX;
+                float dy = (block.startY + block.endY) / 2.0f - centerY;
+                return dx * dx + dy * dy;
+            };
+            std::stable_sort(blocks.begin(), blocks.end(), [&](const RenderBlock &a, const RenderBlock &b) {
+                return distanceToCenter(a) < distanceToCenter(b);
+            });
+        }
+
         // Dynamic Task Fetching using QtConcurrent
-        // Note: Create run logic within a lambda expression.
-        //       Call run and pass the run logic to it to start multi-thread excecution.
-        QFuture<void> future = QtConcurrent::run([&](){
+        // Note: The block list is read-only once the workers start, so each worker claims the next
+        //       block by atomically incrementing a shared index instead of locking a queue.
+        std::atomic<int> nextBlock{0};
+        auto worker = [&]() {
             while (true) {
-                taskQueueMutex.lock();
-                if (taskQueue.isEmpty()) {
-                    taskQueueMutex.unlock();
+                int index = nextBlock.fetch_add(1, std::memory_order_relaxed);
+                if (index >= static_cast<int>(blocks.size())) {
                     break;
                 }
-                auto block = taskQueue.dequeue();
-                taskQueueMutex.unlock();
-
-                renderBlock(imageData, scene, block.first.first, block.first.second, block.second.first, block.second.second);
+                const RenderBlock &block = blocks[index];
+                (this->*renderBlockFunction)(imageData, scene, block.startX, block.startY, block.endX, block.endY);
             }
-        });
+        };
+
+        QThreadPool pool;
+        pool.setMaxThreadCount(numThreads);
+        QList<QFuture<void>> futures;
+        for (int i = 0; i < numThreads; i++) {
+            futures.append(QtConcurrent::run(&pool, worker));
+        }
 
-        // Note: Main thread continue the create watcher and monitor the process.
-        QFutureWatcher<void> watcher;
-        watcher.setFuture(future);
-        watcher.waitForFinished(); // Block the main thread and wait for all tasks to finish
+        // Note: Main thread waits for all workers to finish
+        for (QFuture<void> &future : futures) {
+            future.waitForFinished();
+        }
     }
     else {
-        renderBlock(imageData, scene, 0, 0, scene.width(), scene.height());
+        (this->*renderBlockFunction)(imageData, scene, 0, 0, scene.width(), scene.height());
     }
 
     // Post-filtering for anti-aliasing
@@ -96,91 +127,407 @@ void RayTracer::render(RGBA *imageData, RayTraceScene &scene) {
     postFilter.bilateral2D(imageData, scene.width(), scene.height(), 10);
 }
 
+// Mask of the render features enabled in the config
+unsigned RayTracer::renderFeatures() const {
+    unsigned features = 0;
+    if (m_config.enableAcceleration) features |= FEATURE_ACCELERATION;
+    if (m_config.enableShadow)       features |= FEATURE_SHADOW;
+    if (m_config.enableTextureMap)   features |= FEATURE_TEXTURE_MAP;
+    if (m_config.onlyRenderNormals)  features |= FEATURE_NORMALS;
+    return features;
+}
+
+// Look up the instantiation of renderBlock for a feature mask in a table of all combinations
+template <size_t... Features>
+RayTracer::RenderBlockFunction RayTracer::selectRenderBlock(unsigned features, std::index_sequence<Features...>) {
+    static const RenderBlockFunction renderBlockFunctions[] = {&RayTracer::renderBlock<Features>...};
+    return renderBlockFunctions[features];
+}
+
 // Render a block on the image
+template <unsigned Features>
 void RayTracer::renderBlock(RGBA* imageData, const RayTraceScene& scene, int startX, int startY, int endX, int endY) {
-    int planeW = scene.width();
+    // Note: Only one primary ray per pixel is traced without super-sampling and depth of field, these are traced in packets
+    //       or by the wavefront integrator. The wavefront integrator only computes colors, normals are rendered with packets.
+    if constexpr (!(Features & FEATURE_NORMALS)) {
+        if (m_config.enableWavefront && !m_config.enableSuperSample && !m_config.enableDepthOfField) {
+            renderBlockWavefront<Features>(imageData, scene, startX, startY, endX, endY);
+            return;
+        }
+    }
+    if constexpr ((Features & FEATURE_ACCELERATION) != 0) {
+        if (m_config.enableRayPackets && !m_config.enableSuperSample && !m_config.enableDepthOfField) {
+            renderBlockPackets<Features>(imageData, scene, startX, startY, endX, endY);
+            return;
+        }
+    }
+
+    if (m_config.enableSuperSample) {
+        renderBlockSuperSample<Features>(imageData, scene, startX, startY, endX, endY);
+        return;
+    }
 
     // Iterate on the pixels of a render block
     for (int j = startY; j < endY; j++) {
         for (int i = startX; i < endX; i++) {
-            glm::vec4 illumination;
-            glm::vec3 finalColor = glm::vec3(0);
-            // Adaptive Super-sample (if super-sample is enabled)
-            if (m_config.enableSuperSample) {
-                std::vector<glm::vec4> samples;
-
-                // Initial 4 samples (corners of the pixel)
-                samples.push_back(computeRayColor(scene, calculateRayInfo(scene, i, j), m_config.maxRecursiveDepth));
-                samples.push_back(computeRayColor(scene, calculateRayInfo(scene, i+1, j), m_config.maxRecursiveDepth));
-                samples.push_back(computeRayColor(scene, calculateRayInfo(scene, i, j+1), m_config.maxRecursiveDepth));
-                samples.push_back(computeRayColor(scene, calculateRayInfo(scene, i+1, j+1), m_config.maxRecursiveDepth));
-
-                // Check variance
-                glm::vec4 avgColor = (samples[0] + samples[1] + samples[2] + samples[3]) / 4.0f;
-                float variance = 0.0f;
-                for (const auto& color : samples) {
-                    variance += glm::length(color - avgColor);
+            glm::vec4 illumination(0.0f);
+            Sampler sampler(i, j);
+            if (m_config.enableDepthOfField) {
+                // Adaptive sampling
+                // Note: The sample positions follow the R2 sequence (shifted randomly per pixel), so every prefix of it
+                //       covers the pixel evenly. Sampling stops once the confidence interval of the mean is small enough.
+                const float offsetX = sampler.nextFloat();
+                const float offsetY = sampler.nextFloat();
+                PixelEstimate estimate;
+                while (estimate.count < m_config.adaptiveMaxSamples) {
+                    float si = i + glm::fract(offsetX + estimate.count * 0.7548776662f);
+                    float sj = j + glm::fract(offsetY + estimate.count * 0.5698402910f);
+                    estimate.add(computeRayColor<Features>(scene, calculateRayInfo(scene, si, sj, sampler), 0, sampler));
+                    if (estimate.count >= m_config.adaptiveMinSamples && estimate.confidence() <= m_config.adaptiveTolerance) {
+                        break;
+                    }
+                }
+                illumination = estimate.mean;
+                m_sampleCounts[i + j * scene.width()] = estimate.count;
+            }
+            else {
+                illumination = computeRayColor<Features>(scene, calculateRayInfo(scene, i, j, sampler), 0, sampler);
+            }
+
+            writePixel(imageData, scene, i, j, illumination);
+        }
+    }
+}
+
+// Render a block on the image with adaptive super-sampling
+// Note: Neighboring pixels share their corners, so the corner samples of a row of pixels are kept and reused as the
+//       top corners of the next row. Each corner of the block is traced once.
+template <unsigned Features>
+void RayTracer::renderBlockSuperSample(RGBA* imageData, const RayTraceScene& scene, int startX, int startY, int endX, int endY) {
+    const int cornerCount = endX - startX + 1;
+    std::vector<glm::vec4> topCorners(cornerCount);
+    std::vector<glm::vec4> bottomCorners(cornerCount);
+    for (int c = 0; c < cornerCount; c++) {
+        topCorners[c] = traceSuperSample<Features>(scene, startX + c, startY);
+    }
+
+    for (int j = startY; j < endY; j++) {
+        for (int c = 0; c < cornerCount; c++) {
+            bottomCorners[c] = traceSuperSample<Features>(scene, startX + c, j + 1);
+        }
+        for (int i = startX; i < endX; i++) {
+            const int c = i - startX;
+            const glm::vec4 corners[4] = {topCorners[c], topCorners[c + 1], bottomCorners[c], bottomCorners[c + 1]};
+            int sampleCount = 4;
+            writePixel(imageData, scene, i, j, refineSuperSample<Features>(scene, i, j, 1.0f, corners, 0, sampleCount));
+            m_sampleCounts[i + j * scene.width()] = sampleCount;
+        }
+        std::swap(topCorners, bottomCorners);
+    }
+}
+
+// Trace a super-sample at the image position (x, y) in pixels
+// Note: The sampler is seeded from the position on the finest grid of super-samples, so a sample on the border of two
+//       pixels or blocks has the same value no matter which of them traces it.
+template <unsigned Features>
+glm::vec4 RayTracer::traceSuperSample(const RayTraceScene& scene, float x, float y) {
+    const float gridScale = static_cast<float>(1 << m_config.superSampleMaxDepth);
+    Sampler sampler(static_cast<uint32_t>(x * gridScale), static_cast<uint32_t>(y * gridScale));
+    return computeRayColor<Features>(scene, calculateRayInfo(scene, x, y, sampler), 0, sampler);
+}
+
+// Color of the square [x, x + size] x [y, y + size] from the samples at its corners
+// @param corners  Samples at the top left, top right, bottom left and bottom right corner.
+// Note: If the corners differ by more than the threshold, the square is split into 4 squares. The 5 new samples (the
+//       center and the middle of each edge) are shared by the 4 squares, which are refined recursively.
+template <unsigned Features>
+glm::vec4 RayTracer::refineSuperSample(const RayTraceScene& scene, float x, float y, float size, const glm::vec4 corners[4], int depth, int &sampleCount) {
+    glm::vec4 average = (corners[0] + corners[1] + corners[2] + corners[3]) / 4.0f;
+    if (depth >= m_config.superSampleMaxDepth) {
+        return average;
+    }
+
+    // Check variance
+    float variance = 0.0f;
+    for (int c = 0; c < 4; c++) {
+        variance += glm::length(corners[c] - average);
+    }
+    if (variance <= m_config.superSampleThreshold) {
+        return average;
+    }
+
+    float half = size / 2;
+    glm::vec4 top    = traceSuperSample<Features>(scene, x + half, y);
+    glm::vec4 left   = traceSuperSample<Features>(scene, x, y + half);
+    glm::vec4 center = traceSuperSample<Features>(scene, x + half, y + half);
+    glm::vec4 right  = traceSuperSample<Features>(scene, x + size, y + half);
+    glm::vec4 bottom = traceSuperSample<Features>(scene, x + half, y + size);
+    sampleCount += 5;
+
+    const glm::vec4 topLeft[4]     = {corners[0], top, left, center};
+    const glm::vec4 topRight[4]    = {top, corners[1], center, right};
+    const glm::vec4 bottomLeft[4]  = {left, center, corners[2], bottom};
+    const glm::vec4 bottomRight[4] = {center, right, bottom, corners[3]};
+    return (refineSuperSample<Features>(scene, x, y, half, topLeft, depth + 1, sampleCount) +
+            refineSuperSample<Features>(scene, x + half, y, half, topRight, depth + 1, sampleCount) +
+            refineSuperSample<Features>(scene, x, y + half, half, bottomLeft, depth + 1, sampleCount) +
+            refineSuperSample<Features>(scene, x + half, y + half, half, bottomRight, depth + 1, sampleCount)) / 4.0f;
+}
+
+// Add a sample to the running mean and luminance variance
+void RayTracer::PixelEstimate::add(const glm::vec4 &sample) {
+    // Note: The displayed color is clamped, so the variance of brighter than white samples does not keep sampling
+    float luminance = glm::dot(glm::clamp(glm::vec3(sample), 0.0f, 1.0f), glm::vec3(0.2126f, 0.7152f, 0.0722f));
+    count++;
+    mean += (sample - mean) / static_cast<float>(count);
+    float delta = luminance - luminanceMean;
+    luminanceMean += delta / count;
+    luminanceM2 += delta * (luminance - luminanceMean);
+}
+
+float RayTracer::PixelEstimate::confidence() const {
+    if (count < 2) {
+        return INFINITY;
+    }
+    float variance = luminanceM2 / (count - 1);
+    return 1.96f * std::sqrt(variance / count);
+}
+
+// Render a block on the image with packets of primary rays
+// Note: The primary rays of a tile of neighboring pixels are coherent, so they traverse the scene BVH together.
+//       Shading and all secondary rays (shadows, reflection, refraction) are traced per ray.
+template <unsigned Features>
+void RayTracer::renderBlockPackets(RGBA* imageData, const RayTraceScene& scene, int startX, int startY, int endX, int endY) {
+    const int TILE_SIZE = 4; // 4x4 rays per packet
+
+    RayPacket packet;
+    Hit hits[RAY_PACKET_SIZE];
+    for (int tileY = startY; tileY < endY; tileY += TILE_SIZE) {
+        for (int tileX = startX; tileX < endX; tileX += TILE_SIZE) {
+            int tileEndX = std::min(tileX + TILE_SIZE, endX);
+            int tileEndY = std::min(tileY + TILE_SIZE, endY);
+
+            packet.size = 0;
+            for (int j = tileY; j < tileEndY; j++) {
+                for (int i = tileX; i < tileEndX; i++) {
+                    Sampler sampler(i, j);
+                    packet.rays[packet.size++] = calculateRayInfo(scene, i, j, sampler);
                 }
+            }
 
-                const float threshold = 0.1f;  // adjust as needed
-                if (variance > threshold) {
-                    // Add more samples
-                    samples.push_back(computeRayColor(scene, calculateRayInfo(scene, i+0.5, j), 0));
-                    samples.push_back(computeRayColor(scene, calculateRayInfo(scene, i, j+0.5), 0));
-                    samples.push_back(computeRayColor(scene, calculateRayInfo(scene, i+0.5, j+0.5), 0));
-                    samples.push_back(computeRayColor(scene, calculateRayInfo(scene, i+1, j+0.5), 0));
-                    samples.push_back(computeRayColor(scene, calculateRayInfo(scene, i+0.5, j+1), 0));
+            calculatePacketIntersection(scene, packet, hits);
+
+            int r = 0;
+            for (int j = tileY; j < tileEndY; j++) {
+                for (int i = tileX; i < tileEndX; i++, r++) {
+                    Sampler sampler(i, j);
+                    writePixel(imageData, scene, i, j, computeRayColor<Features>(scene, packet.rays[r], hits[r], 0, sampler));
                 }
+            }
+        }
+    }
+}
+
+// Spread the lower 10 bits of v so that there are two zero bits between neighboring bits
+static uint32_t expandBits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
 
-                // Average the colors
-                for (const auto& color : samples) {
-                    illumination += color;
+// Compute the order in which the rays of a wavefront are traced: by the octant of their direction, then along a
+// Morton curve over their origins
+// Note: Rays that start close to each other in the same direction tend to visit the same BVH nodes and shapes.
+//       Only the keys are sorted, each one holds the index of its ray in the lower 32 bits, so rays with the same key
+//       keep the order in which they were generated.
+void RayTracer::sortWavefront(const std::vector<WavefrontRay> &rays, std::vector<uint64_t> &order) {
+    AABB bounds;
+    for (const WavefrontRay &r : rays) {
+        bounds.extend(glm::vec3(r.ray.origin));
+    }
+    glm::vec3 scale = 511.0f / glm::max(bounds.maxBounds - bounds.minBounds, glm::vec3(1e-6f));
+
+    order.resize(rays.size());
+    for (size_t i = 0; i < rays.size(); i++) {
+        // 3 bits of octant and 9 bits per axis of origin
+        const Ray &ray = rays[i].ray;
+        glm::uvec3 cell = glm::uvec3((glm::vec3(ray.origin) - bounds.minBounds) * scale);
+        uint32_t octant = (ray.direction.x < 0) | (ray.direction.y < 0) << 1 | (ray.direction.z < 0) << 2;
+        uint32_t key = octant << 27 | expandBits(cell.x) << 2 | expandBits(cell.y) << 1 | expandBits(cell.z);
+        order[i] = static_cast<uint64_t>(key) << 32 | i;
+    }
+    std::sort(order.begin(), order.end());
+}
+
+// Render a block on the image with the wavefront integrator
+// Note: Instead of following the rays of each pixel to the end, all rays of one bounce are generated first, sorted and
+//       intersected as a batch. Their hits are then shaded as a batch, which yields the shadow rays (traced as a batch,
+//       too) and the reflected and refracted rays of the next bounce. Each secondary ray is traced once
+//       and carries the weight of its path, rays with little or no weight are dropped (see continuePath).
+template <unsigned Features>
+void RayTracer::renderBlockWavefront(RGBA* imageData, const RayTraceScene& scene, int startX, int startY, int endX, int endY) {
+    // Note: All rays of a bounce are kept in memory, so the block is rendered in parts of 16x16 pixels to keep a
+    //       wavefront small. The buffers are reused for all parts and all blocks of a thread, so rendering a block
+    //       does not allocate memory once they have grown.
+    const int WAVEFRONT_SIZE = 16;
+    const int TILE_SIZE = 4;
+    const SceneGlobalData &globalData = scene.sceneMetaData.globalData;
+
+    static thread_local std::vector<glm::vec3> radiance;
+    static thread_local std::vector<WavefrontRay> rays;
+    static thread_local std::vector<WavefrontRay> nextRays;
+    static thread_local std::vector<ShadowRay> shadowRays;
+    static thread_local std::vector<uint64_t> order;
+    static thread_local std::vector<Hit> hits;
+    rays.clear();
+
+    for (int waveStartY = startY; waveStartY < endY; waveStartY += WAVEFRONT_SIZE) {
+        for (int waveStartX = startX; waveStartX < endX; waveStartX += WAVEFRONT_SIZE) {
+            const int waveEndX = std::min(waveStartX + WAVEFRONT_SIZE, endX);
+            const int waveEndY = std::min(waveStartY + WAVEFRONT_SIZE, endY);
+            const int waveWidth = waveEndX - waveStartX;
+            radiance.assign(waveWidth * (waveEndY - waveStartY), glm::vec3(0));
+
+            // Primary rays in 4x4 tiles
+            for (int tileY = waveStartY; tileY < waveEndY; tileY += TILE_SIZE) {
+                for (int tileX = waveStartX; tileX < waveEndX; tileX += TILE_SIZE) {
+                    for (int j = tileY; j < std::min(tileY + TILE_SIZE, waveEndY); j++) {
+                        for (int i = tileX; i < std::min(tileX + TILE_SIZE, waveEndX); i++) {
+                            Sampler sampler(i, j);
+                            rays.push_back({calculateRayInfo(scene, i, j, sampler), glm::vec3(1), (i - waveStartX) + (j - waveStartY) * waveWidth, 1});
+                        }
+                    }
                 }
-                illumination /= static_cast<float>(samples.size());
             }
-            else {
-                if (m_config.enableDepthOfField) {
-                    const int SAMPLES_PER_AXIS = 3; // 3x3 super-sampling
-                    const float SAMPLE_STEP = 1.0f / SAMPLES_PER_AXIS;
-
-                    // Super-sampling
-                    for (int sx = 0; sx < SAMPLES_PER_AXIS; sx++) {
-                        for (int sy = 0; sy < SAMPLES_PER_AXIS; sy++) {
-                            float si = i + sx * SAMPLE_STEP;
-                            float sj = j + sy * SAMPLE_STEP;
-                            illumination += computeRayColor(scene, calculateRayInfo(scene, si, sj), 0);
+
+            for (int recursionDepth = 0; !rays.empty(); recursionDepth++) {
+                sortWavefront(rays, order);
+                traceWavefront<Features>(scene, rays, order, hits);
+
+                // Shade the hits
+                shadowRays.clear();
+                nextRays.clear();
+                for (size_t r = 0; r < rays.size(); r++) {
+                    if (hits[r].shapeIndex < 0) {
+                        continue;
+                    }
+                    const Ray &ray = rays[r].ray;
+                    const glm::vec3 weight = rays[r].weight;
+                    const int pixel = rays[r].pixel;
+                    const uint32_t path = rays[r].path;
+                    const RenderShapeData &intersectShape = scene.sceneMetaData.shapes[hits[r].shapeIndex];
+                    const SceneMaterial &material = intersectShape.primitive.material;
+                    float t = hits[r].t;
+                    glm::vec3 normal = hits[r].normal;
+
+                    glm::vec4 illumination(0, 0, 0, 1);
+                    size_t firstShadowRay = shadowRays.size();
+                    Sampler sampler(waveStartX + pixel % waveWidth, waveStartY + pixel / waveWidth, path);
+                    calculateLighting<Features>(scene, ray, t, normal, intersectShape, illumination, sampler, &shadowRays);
+                    radiance[pixel] += weight * illumination.xyz();
+                    for (size_t s = firstShadowRay; s < shadowRays.size(); s++) {
+                        shadowRays[s].contribution *= weight;
+                        shadowRays[s].pixel = pixel;
+                    }
+
+                    if (recursionDepth >= m_config.maxRecursiveDepth) {
+                        continue;
+                    }
+
+                    // Reflection and refraction, built the same way as in computeRayColor
+                    glm::vec4 d = ray.direction;
+                    if (m_config.enableReflection && glm::length(material.cReflective) > 0) {
+                        glm::vec4 intersectPos = ray.origin + t * d;
+                        d = glm::normalize(d);
+                        normal = glm::normalize(normal);
+                        glm::vec3 reflectWeight = weight * globalData.ks * material.cReflective.xyz();
+                        if (continuePath(reflectWeight, sampler)) {
+                            nextRays.push_back({calculateReflectRay(intersectPos, d, normal), reflectWeight, pixel, 2 * path});
+                        }
+                    }
+                    if (m_config.enableRefraction) {
+                        glm::vec4 intersectPosIn = ray.origin + (t + 0.01f) * d;
+                        d = glm::normalize(d);
+                        normal = glm::normalize(normal);
+                        glm::vec3 refractWeight = weight * globalData.kt * material.cTransparent.xyz();
+                        if (continuePath(refractWeight, sampler)) {
+                            nextRays.push_back({calculateRefractRay(intersectPosIn, d, normal, intersectShape), refractWeight, pixel, 2 * path + 1});
                         }
                     }
-                    illumination /= (SAMPLES_PER_AXIS * SAMPLES_PER_AXIS); // Average the sampled colors
                 }
-                else {
-                    illumination = computeRayColor(scene, calculateRayInfo(scene, i, j), 0);
+
+                // Trace the shadow rays of the bounce
+                // Note: These are not sorted, the shadow rays of a hit share their origin and are already adjacent, and
+                //       the hits were shaded in sorted order
+                for (const ShadowRay &shadowRay : shadowRays) {
+                    if (!isOccluded<Features>(scene, shadowRay.ray)) {
+                        radiance[shadowRay.pixel] += shadowRay.contribution;
+                    }
                 }
-            }
 
-            // Convert to [0,255] to get the final color
-            if (m_config.onlyRenderNormals) {
-                mapNormalColor(illumination.xyz(), finalColor);
+                std::swap(rays, nextRays);
             }
-            else {
-                mapIlluminationColor(illumination.xyz(), finalColor);
+
+            for (int j = waveStartY; j < waveEndY; j++) {
+                for (int i = waveStartX; i < waveEndX; i++) {
+                    writePixel(imageData, scene, i, j, glm::vec4(radiance[(i - waveStartX) + (j - waveStartY) * waveWidth], 1));
+                }
             }
+        }
+    }
+}
+
+// Find the closest hit of each ray of a wavefront, the rays are traced in the given order
+// Note: With acceleration, rays that are consecutive in the order are intersected as packets
+template <unsigned Features>
+void RayTracer::traceWavefront(const RayTraceScene& scene, const std::vector<WavefrontRay> &rays, const std::vector<uint64_t> &order, std::vector<Hit> &hits) {
+    hits.assign(rays.size(), Hit());
+    if constexpr (!(Features & FEATURE_ACCELERATION)) {
+        for (uint64_t entry : order) {
+            uint32_t r = static_cast<uint32_t>(entry);
+            calculateIntersection<Features>(scene, rays[r].ray, hits[r]);
+        }
+        return;
+    }
 
-            imageData[i + j * planeW].r = static_cast<uint8_t>(finalColor.r);
-            imageData[i + j * planeW].g = static_cast<uint8_t>(finalColor.g);
-            imageData[i + j * planeW].b = static_cast<uint8_t>(finalColor.b);
+    RayPacket packet;
+    Hit packetHits[RAY_PACKET_SIZE];
+    for (size_t first = 0; first < order.size(); first += RAY_PACKET_SIZE) {
+        packet.size = static_cast<int>(std::min<size_t>(RAY_PACKET_SIZE, order.size() - first));
+        for (int r = 0; r < packet.size; r++) {
+            packet.rays[r] = rays[static_cast<uint32_t>(order[first + r])].ray;
+        }
+        calculatePacketIntersection(scene, packet, packetHits);
+        for (int r = 0; r < packet.size; r++) {
+            hits[static_cast<uint32_t>(order[first + r])] = packetHits[r];
         }
     }
 }
 
-// Calculate the ray info that is shooting from camera
-std::vector<glm::vec4> RayTracer::calculateRayInfo(const RayTraceScene& scene, float i, float j) {
-    std::vector<glm::vec4> ray;
+// Convert the illumination to [0,255] and store it as the color of a pixel
+void RayTracer::writePixel(RGBA* imageData, const RayTraceScene& scene, int i, int j, const glm::vec4 &illumination) {
+    glm::vec3 finalColor = glm::vec3(0);
+    if (m_config.onlyRenderNormals) {
+        mapNormalColor(illumination.xyz(), finalColor);
+    }
+    else {
+        mapIlluminationColor(illumination.xyz(), finalColor);
+    }
+
+    int planeW = scene.width();
+    imageData[i + j * planeW].r = static_cast<uint8_t>(finalColor.r);
+    imageData[i + j * planeW].g = static_cast<uint8_t>(finalColor.g);
+    imageData[i + j * planeW].b = static_cast<uint8_t>(finalColor.b);
+}
 
+// Calculate the ray info that is shooting from camera
+Ray RayTracer::calculateRayInfo(const RayTraceScene& scene, float i, float j, Sampler &sampler) {
     // Get camera and ray info
     glm::vec4 cameraPos = scene.getCamera().cameraPos;
-    glm::mat4 viewMatrix = scene.getCamera().getViewMatrix();
-    glm::mat4 viewMatrixInverse = scene.getCamera().getViewMatrixInverse();
+    const glm::mat4 &viewMatrix = scene.getCamera().getViewMatrix();
+    const glm::mat4 &viewMatrixInverse = scene.getCamera().getViewMatrixInverse();
     float cameraHeightAngle = scene.getCamera().getHeightAngle();
     int planeH = scene.height();
     int planeW = scene.width();
@@ -206,7 +553,7 @@ std::vector<glm::vec4> RayTracer::calculateRayInfo(const RayTraceScene& scene, f
 //        float lensRadius = scene.getCamera().getAperture();
 //        float r = lensRadius * sqrt(static_cast<float>(rand()) / RAND_MAX);
         float r = lensRadius * 2;
-        float theta = 2 * M_PI * (static_cast<float>(rand()) / RAND_MAX);
+        float theta = 2 * M_PI * sampler.nextFloat();
         glm::vec4 lensOffset(r * cos(theta), r * sin(theta), 0, 0);
 
         // Adjust ray direction for depth of field
@@ -217,120 +564,172 @@ std::vector<glm::vec4> RayTracer::calculateRayInfo(const RayTraceScene& scene, f
 
         d = viewMatrixInverse * dCameraSpace; // To World Space
 
-        ray.push_back(viewMatrixInverse * eye);
-        ray.push_back(d);
-
-        return ray;
+        return Ray(viewMatrixInverse * eye, d, 0, MAX_RAY_DISTANCE);
     }
     else {
         d = viewMatrixInverse * (uvk - viewMatrix*cameraPos); // Ray to World Space
 
-        ray.push_back(cameraPos);
-        ray.push_back(d);
-
-        return ray;
+        return Ray(cameraPos, d, 0, MAX_RAY_DISTANCE);
     }
 }
 
 
 /************************** Functions for computing ray intersect colors **************************/
-glm::vec4 RayTracer::computeRayColor(const RayTraceScene& scene, std::vector<glm::vec4> ray, int recursionDepth) {
-    glm::vec4 cameraPos = ray.at(0);
-    glm::vec4 d = ray.at(1);
-
+template <unsigned Features>
+glm::vec4 RayTracer::computeRayColor(const RayTraceScene& scene, const Ray &ray, int recursionDepth, Sampler &sampler) {
     // Calculate intersections
-    float t = 1000; // used to track the nearest intersection
-    glm::vec3 normal{-1, -1, -1};
-    RenderShapeData intersectShape; // The intersected shape that used to calculate lighting
-    bool isIntersect;
-    if (m_config.enableAcceleration) {
-        std::vector<RenderShapeData> potentialIntersectShapes = m_bvh->potentialIntersections(cameraPos, d); // BVH version
-        isIntersect = calculateIntersection(potentialIntersectShapes, cameraPos, d, t, normal,intersectShape);
-    }
-    else {
-        std::vector<RenderShapeData> potentialIntersectShapes = scene.sceneMetaData.shapes;
-        isIntersect = calculateIntersection(potentialIntersectShapes, cameraPos, d, t, normal,intersectShape);
+    Hit hit;
+    calculateIntersection<Features>(scene, ray, hit);
+    return computeRayColor<Features>(scene, ray, hit, recursionDepth, sampler);
+}
+
+// Compute the color of a ray whose closest hit is already known (shapeIndex is -1 if nothing is hit)
+// Note: When only normals are rendered, the normal facing the ray is returned without tracing secondary rays.
+//       The tree of reflected and refracted rays is evaluated iteratively with a stack. Each secondary ray is traced
+//       once and carries the product of the weights along its path (throughput), its color is added scaled by it.
+template <unsigned Features>
+glm::vec4 RayTracer::computeRayColor(const RayTraceScene& scene, const Ray &ray, const Hit &hit, int recursionDepth, Sampler &sampler) {
+    if constexpr ((Features & FEATURE_NORMALS) != 0) {
+        glm::vec3 normal = hit.normal;
+        if (hit.shapeIndex >= 0) {
+            glm::vec4 illumination(0, 0, 0, 1);
+            calculateLighting<Features>(scene, ray, hit.t, normal, scene.sceneMetaData.shapes[hit.shapeIndex], illumination, sampler);
+        }
+        return glm::vec4(normal, 1);
     }
 
-    // Calculate lighting (if intersect with some shape)
-    glm::vec4 illumination(0, 0, 0, 1);
-    if (isIntersect) {
-        calculateLighting(scene, cameraPos, d, t, normal, intersectShape, illumination);
+    const SceneGlobalData &globalData = scene.sceneMetaData.globalData;
+
+    // Note: The stack is reused by all rays of a thread, so evaluating a ray tree does not allocate memory
+    static thread_local std::vector<PathRay> pathRays;
+    pathRays.clear();
+    pathRays.push_back({ray, glm::vec3(1), recursionDepth});
+
+    glm::vec3 color(0);
+    bool isPrimary = true;
+    while (!pathRays.empty()) {
+        const PathRay pathRay = pathRays.back();
+        pathRays.pop_back();
+
+        // Calculate intersections (the hit of the first ray is given)
+        Hit pathHit;
+        if (isPrimary) {
+            pathHit = hit;
+            isPrimary = false;
+        }
+        else {
+            calculateIntersection<Features>(scene, pathRay.ray, pathHit);
+        }
+        if (pathHit.shapeIndex < 0) {
+            continue;
+        }
+
+        // Calculate lighting
+        const RenderShapeData &intersectShape = scene.sceneMetaData.shapes[pathHit.shapeIndex];
+        const SceneMaterial &material = intersectShape.primitive.material;
+        float t = pathHit.t;
+        glm::vec3 normal = pathHit.normal;
+        glm::vec4 illumination(0, 0, 0, 1);
+        calculateLighting<Features>(scene, pathRay.ray, t, normal, intersectShape, illumination, sampler);
+        color += pathRay.throughput * illumination.xyz();
+
+        if (pathRay.recursionDepth >= m_config.maxRecursiveDepth) {
+            continue;
+        }
 
         // Reflection
-        if (m_config.enableReflection && glm::length(intersectShape.primitive.material.cReflective) == 0) {
-            glm::vec4 intersectPos = cameraPos + t * d;
+        glm::vec4 d = pathRay.ray.direction;
+        if (m_config.enableReflection && glm::length(material.cReflective) > 0) {
+            glm::vec4 intersectPos = pathRay.ray.origin + t * d;
             d = glm::normalize(d);
             normal = glm::normalize(normal);
-            glm::vec4 reflectDirection = d - 2.0f * glm::dot(glm::vec4(normal, 0.0f), d) * glm::vec4(normal, 0.0f);
-            ray.at(0) = intersectPos;
-            ray.at(1) = reflectDirection;
-            if (m_config.enableReflection && recursionDepth < m_config.maxRecursiveDepth) {
-                illumination.x += scene.sceneMetaData.globalData.ks * intersectShape.primitive.material.cReflective.x * computeRayColor(scene, ray, recursionDepth+1).x;
-                illumination.y += scene.sceneMetaData.globalData.ks * intersectShape.primitive.material.cReflective.y * computeRayColor(scene, ray, recursionDepth+1).y;
-                illumination.z += scene.sceneMetaData.globalData.ks * intersectShape.primitive.material.cReflective.z * computeRayColor(scene, ray, recursionDepth+1).z;
-                illumination.w = 1;
+            glm::vec3 reflectThroughput = pathRay.throughput * globalData.ks * material.cReflective.xyz();
+            if (continuePath(reflectThroughput, sampler)) {
+                pathRays.push_back({calculateReflectRay(intersectPos, d, normal), reflectThroughput, pathRay.recursionDepth + 1});
             }
         }
 
         // Refraction
         if (m_config.enableRefraction) {
-            TNormalTuple intersectTuple;
-            PrimitiveFunction pf;
-            float intersectIn;
-            glm::vec3 normalIn;
-
-            glm::vec4 intersectPosIn = cameraPos + (t + 0.01f) * d;
+            glm::vec4 intersectPosIn = pathRay.ray.origin + (t + 0.01f) * d;
             d = glm::normalize(d);
             normal = glm::normalize(normal);
-            glm::vec4 refractDirectionIn = refractDirection(d, normal, intersectShape.primitive.material.ior);
-
-            glm::mat4 ctm = intersectShape.ctm;
-            glm::vec4 pObjectSpace = glm::inverse(ctm) * intersectPosIn; // Ray to Object Space
-            glm::vec4 dObjectSpace = glm::inverse(ctm) * refractDirectionIn; // Ray to Object Space
-            glm::mat3 upperLeft33(ctm[0].x, ctm[0].y, ctm[0].z,
-                                  ctm[1].x, ctm[1].y, ctm[1].z,
-                                  ctm[2].x, ctm[2].y, ctm[2].z);
-            if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_SPHERE) {
-                intersectTuple = pf.sphereIntersectInside(pObjectSpace, dObjectSpace);
-            }
-            if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_CUBE) {
-                intersectTuple = pf.cubeIntersectFromInside(pObjectSpace, dObjectSpace);
-            }
-            if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_CYLINDER) {
-                intersectTuple = pf.cylinderIntersectInside(pObjectSpace, dObjectSpace);
-            }
-            if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_CONE) {
-                intersectTuple = pf.coneIntersectInside(pObjectSpace, dObjectSpace);
-            }
-
-            intersectIn = std::get<0>(intersectTuple);
-            if (intersectIn > 0) {
-                glm::vec3 normalInObjectSpace = std::get<1>(intersectTuple);
-                normalIn = glm::inverse(glm::transpose(upperLeft33)) * normalInObjectSpace; // Normal to World Space
-                normalIn = normalIn / glm::length(normalIn);
+            glm::vec3 refractThroughput = pathRay.throughput * globalData.kt * material.cTransparent.xyz();
+            if (continuePath(refractThroughput, sampler)) {
+                pathRays.push_back({calculateRefractRay(intersectPosIn, d, normal, intersectShape), refractThroughput, pathRay.recursionDepth + 1});
             }
+        }
+    }
 
-            glm::vec4 intersectPosOut = intersectPosIn + intersectIn * refractDirectionIn;
-            glm::vec4 refractDirectionOut = refractDirection(refractDirectionIn, normalIn, intersectShape.primitive.material.ior);
+    return glm::vec4(color, 1);
+}
 
-            ray.at(0) = intersectPosOut;
-            ray.at(1) = refractDirectionOut;
-            if (m_config.enableRefraction && recursionDepth < m_config.maxRecursiveDepth) {
-                illumination.x += scene.sceneMetaData.globalData.kt * intersectShape.primitive.material.cTransparent.x * computeRayColor(scene, ray, recursionDepth+1).x;
-                illumination.y += scene.sceneMetaData.globalData.kt * intersectShape.primitive.material.cTransparent.y * computeRayColor(scene, ray, recursionDepth+1).y;
-                illumination.z += scene.sceneMetaData.globalData.kt * intersectShape.primitive.material.cTransparent.z * computeRayColor(scene, ray, recursionDepth+1).z;
-                illumination.w = 1;
-            }
-        }
+// Decide whether a secondary ray with the given throughput is traced
+// Note: Rays without throughput are dropped. Below the minimum throughput, a ray is continued by Russian roulette with
+//       a probability proportional to its throughput, and a surviving ray is weighted up so the image stays unbiased.
+bool RayTracer::continuePath(glm::vec3 &throughput, Sampler &sampler) {
+    float maxThroughput = std::max(throughput.x, std::max(throughput.y, throughput.z));
+    if (maxThroughput <= 0) {
+        return false;
+    }
+    if (maxThroughput >= m_config.minThroughput) {
+        return true;
     }
+    float survivalProbability = maxThroughput / m_config.minThroughput;
+    if (sampler.nextFloat() >= survivalProbability) {
+        return false;
+    }
+    throughput /= survivalProbability;
+    return true;
+}
 
-    if (m_config.onlyRenderNormals) {
-        return glm::vec4(normal, 1);
+// Calculate the reflected ray at a hit position
+// @param d       Normalized direction of the incoming ray.
+// @param normal  Normalized normal at the hit.
+Ray RayTracer::calculateReflectRay(const glm::vec4 &intersectPos, const glm::vec4 &d, const glm::vec3 &normal) {
+    glm::vec4 reflectDirection = d - 2.0f * glm::dot(glm::vec4(normal, 0.0f), d) * glm::vec4(normal, 0.0f);
+    return Ray(intersectPos, reflectDirection, 0, MAX_RAY_DISTANCE);
+}
+
+// Calculate the ray that leaves the shape after being refracted into it and out of it again
+// @param intersectPosIn  Position slightly inside the shape where the ray enters.
+// @param d               Normalized direction of the incoming ray.
+// @param normal          Normalized normal at the entry.
+Ray RayTracer::calculateRefractRay(const glm::vec4 &intersectPosIn, const glm::vec4 &d, const glm::vec3 &normal, const RenderShapeData &intersectShape) {
+    TNormalTuple intersectTuple;
+    PrimitiveFunction pf;
+    float intersectIn;
+    glm::vec3 normalIn(0.0f);
+
+    glm::vec4 refractDirectionIn = refractDirection(d, normal, intersectShape.primitive.material.ior);
+
+    glm::vec4 pObjectSpace = intersectShape.inverseCTM * intersectPosIn; // Ray to Object Space
+    glm::vec4 dObjectSpace = intersectShape.inverseCTM * refractDirectionIn; // Ray to Object Space
+    if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_SPHERE) {
+        intersectTuple = pf.sphereIntersectInside(pObjectSpace, dObjectSpace);
     }
-    else {
-        return illumination;
+    if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_CUBE) {
+        intersectTuple = pf.cubeIntersectFromInside(pObjectSpace, dObjectSpace);
+    }
+    if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_CYLINDER) {
+        intersectTuple = pf.cylinderIntersectInside(pObjectSpace, dObjectSpace);
     }
+    if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_CONE) {
+        intersectTuple = pf.coneIntersectInside(pObjectSpace, dObjectSpace);
+    }
+
+    intersectIn = std::get<0>(intersectTuple);
+    if (intersectIn > 0) {
+        glm::vec3 normalInObjectSpace = std::get<1>(intersectTuple);
+        normalIn = intersectShape.normalMatrix * normalInObjectSpace; // Normal to World Space
+        normalIn = normalIn / glm::length(normalIn);
+    }
+
+    glm::vec4 intersectPosOut = intersectPosIn + intersectIn * refractDirectionIn;
+    glm::vec4 refractDirectionOut = refractDirection(refractDirectionIn, normalIn, intersectShape.primitive.material.ior);
+
+
+    return Ray(intersectPosOut, refractDirectionOut, 0, MAX_RAY_DISTANCE);
 }
 
 // Calculate the direction of refracted ray
@@ -357,96 +756,233 @@ glm::vec4 RayTracer::refractDirection(const glm::vec4& d, const glm::vec3& norma
 }
 
 
-bool RayTracer::calculateIntersection(std::vector<RenderShapeData> &shapes, glm::vec4 &cameraPos, glm::vec4 &d, float &t, glm::vec3 &normal, RenderShapeData &intersectShape) {
-    TNormalTuple intersectTuple;
-    PrimitiveFunction pf;
-    float nearestIntersect;
-
-    bool isIntersect = false;
-    for (RenderShapeData &shape : shapes) {
-        glm::mat4 ctm = shape.ctm;
-        glm::vec4 pObjectSpace = glm::inverse(ctm) * cameraPos; // Ray to Object Space
-        glm::vec4 dObjectSpace = glm::inverse(ctm) * d;         // Ray to Object Space
-        glm::mat3 upperLeft33(ctm[0].x, ctm[0].y, ctm[0].z,
-                              ctm[1].x, ctm[1].y, ctm[1].z,
-                              ctm[2].x, ctm[2].y, ctm[2].z);
-        switch (shape.primitive.type) {
-            case PrimitiveType::PRIMITIVE_CUBE:
-                intersectTuple = pf.cubeIntersect(pObjectSpace, dObjectSpace);
-                break;
+// Find the nearest intersection of the ray with the shapes of the scene within (tMin, tMax)
+template <unsigned Features>
+bool RayTracer::calculateIntersection(const RayTraceScene &scene, const Ray &ray, Hit &hit) {
+    const std::vector<RenderShapeData> &shapes = scene.sceneMetaData.shapes;
 
-            case PrimitiveType::PRIMITIVE_CONE:
-                intersectTuple = pf.coneIntersect(pObjectSpace, dObjectSpace);
-                break;
+    // Note: Only keep the surface of the closest hit so far, the normal is computed for the final hit only
+    PrimitiveHit closestPrimitiveHit;
+    auto intersect = [&](int shapeIndex, float tNearest) {
+        PrimitiveHit primitiveHit = intersectPrimitive(shapes[shapeIndex], ray, tNearest);
+        if (primitiveHit.t > ray.tMin && primitiveHit.t < tNearest) {
+            closestPrimitiveHit = primitiveHit;
+        }
+        return primitiveHit.t;
+    };
 
-            case PrimitiveType::PRIMITIVE_CYLINDER:
-                intersectTuple = pf.cylinderIntersect(pObjectSpace, dObjectSpace);
-                break;
+    float t = ray.tMax;
+    int shapeIndex = -1;
+    if constexpr ((Features & FEATURE_ACCELERATION) != 0) {
+        shapeIndex = m_bvh->closestHit(ray, t, intersect); // BVH version
+    }
+    else {
+        for (int i = 0; i < static_cast<int>(shapes.size()); i++) {
+            float tHit = intersect(i, t);
+            if (tHit > ray.tMin && tHit < t) {
+                t = tHit;
+                shapeIndex = i;
+            }
+        }
+    }
 
-            case PrimitiveType::PRIMITIVE_SPHERE:
-                intersectTuple = pf.sphereIntersect(pObjectSpace, dObjectSpace);
-                break;
+    if (shapeIndex < 0) {
+        return false;
+    }
 
-            case PrimitiveType::PRIMITIVE_MESH:
-                // Find potential triangles the ray might intersect using the BVH
-                std::vector<int> potentialTriangleIndices = shape.triangleBVH->potentialIntersectionsForMesh(pObjectSpace, dObjectSpace);
+    hit.shapeIndex = shapeIndex;
+    hit.t = t;
+    hit.normal = worldNormal(shapes[shapeIndex], ray, closestPrimitiveHit);
+    return true;
+}
 
-                Mesh mesh = MeshCache::getInstance().loadMeshWithCache(shape.primitive.meshfile);
+// Find the nearest intersection of each ray of a packet, the rays traverse the scene BVH together
+void RayTracer::calculatePacketIntersection(const RayTraceScene &scene, const RayPacket &packet, Hit hits[]) {
+    const std::vector<RenderShapeData> &shapes = scene.sceneMetaData.shapes;
 
-                float closestIntersection = 1000;
-                TNormalTuple closestIntersectTuple;
+    PrimitiveHit closestPrimitiveHits[RAY_PACKET_SIZE];
+    auto intersect = [&](int r, int shapeIndex, float tNearest) {
+        PrimitiveHit primitiveHit = intersectPrimitive(shapes[shapeIndex], packet.rays[r], tNearest);
+        if (primitiveHit.t > packet.rays[r].tMin && primitiveHit.t < tNearest) {
+            closestPrimitiveHits[r] = primitiveHit;
+        }
+        return primitiveHit.t;
+    };
+
+    float t[RAY_PACKET_SIZE];
+    int shapeIndices[RAY_PACKET_SIZE];
+    m_bvh->closestHitPacket(packet, t, shapeIndices, intersect);
+
+    for (int r = 0; r < packet.size; r++) {
+        hits[r] = Hit();
+        if (shapeIndices[r] >= 0) {
+            hits[r].shapeIndex = shapeIndices[r];
+            hits[r].t = t[r];
+            hits[r].normal = worldNormal(shapes[shapeIndices[r]], packet.rays[r], closestPrimitiveHits[r]);
+        }
+    }
+}
 
-                // Intersect ray with these potential triangles
-                for (int triangleIndex : potentialTriangleIndices) {
-                    Face face = mesh.faces[triangleIndex];
+// Compute the normalized world space normal of a hit returned by intersectPrimitive
+glm::vec3 RayTracer::worldNormal(const RenderShapeData &shape, const Ray &ray, const PrimitiveHit &hit) {
+    glm::vec3 normal = shape.normalMatrix * primitiveNormal(shape, ray, hit); // Normal to World Space
+    return normal / glm::length(normal);
+}
 
-                    Triangle triangle;
-                    triangle.v0 = mesh.vertices[face.v[0]];
-                    triangle.v1 = mesh.vertices[face.v[1]];
-                    triangle.v2 = mesh.vertices[face.v[2]];
+// Check whether the ray hits any shape within (tMin, tMax), used for shadow rays
+// Note: Terminates on the first hit found instead of searching for the nearest one
+template <unsigned Features>
+bool RayTracer::isOccluded(const RayTraceScene &scene, const Ray &ray) {
+    const std::vector<RenderShapeData> &shapes = scene.sceneMetaData.shapes;
 
-                    TNormalTuple currentIntersectTuple = pf.triangleIntersect(pObjectSpace, dObjectSpace, triangle);
+    auto intersect = [&](int shapeIndex, float tNearest) {
+        return intersectPrimitive(shapes[shapeIndex], ray, tNearest, true).t;
+    };
 
-                    if (std::get<0>(currentIntersectTuple) > 0 && std::get<0>(currentIntersectTuple) < closestIntersection) {
-                        closestIntersection = std::get<0>(currentIntersectTuple);
-                        closestIntersectTuple = currentIntersectTuple;
-                    }
-                }
+    if constexpr ((Features & FEATURE_ACCELERATION) != 0) {
+        return m_bvh->anyHit(ray, intersect); // BVH version
+    }
 
-                intersectTuple = closestIntersectTuple;
-                break;
+    for (int i = 0; i < static_cast<int>(shapes.size()); i++) {
+        float tHit = intersect(i, ray.tMax);
+        if (tHit > ray.tMin && tHit < ray.tMax) {
+            return true;
         }
-        nearestIntersect = std::get<0>(intersectTuple);
-        if (nearestIntersect > 0 && nearestIntersect < t) {
-            isIntersect = true;
-            t = nearestIntersect;
-            glm::vec3 normalObjectSpace = std::get<1>(intersectTuple);
-            normal = glm::inverse(glm::transpose(upperLeft33)) * normalObjectSpace; // Normal to World Space
-            normal = normal / glm::length(normal);
+    }
+    return false;
+}
+
+// Intersect the ray with a single shape and return the distance and the surface that is hit
+// Note: For meshes, triangles farther than tMax are skipped and the surface is the index of the hit triangle.
+//       If anyHit is set, the first triangle hit within tMax is returned instead of the closest one.
+PrimitiveHit RayTracer::intersectPrimitive(const RenderShapeData &shape, const Ray &ray, float tMax, bool anyHit) {
+    PrimitiveFunction pf;
+    glm::vec4 pObjectSpace = shape.inverseCTM * ray.origin;    // Ray to Object Space
+    glm::vec4 dObjectSpace = shape.inverseCTM * ray.direction; // Ray to Object Space
+
+    switch (shape.primitive.type) {
+        case PrimitiveType::PRIMITIVE_CUBE:
+            return pf.cubeIntersect(pObjectSpace, dObjectSpace);
 
-            intersectShape = shape;
+        case PrimitiveType::PRIMITIVE_CONE:
+            return pf.coneIntersect(pObjectSpace, dObjectSpace);
+
+        case PrimitiveType::PRIMITIVE_CYLINDER:
+            return pf.cylinderIntersect(pObjectSpace, dObjectSpace);
+
+        case PrimitiveType::PRIMITIVE_SPHERE:
+            return pf.sphereIntersect(pObjectSpace, dObjectSpace);
+
+        case PrimitiveType::PRIMITIVE_MESH: {
+            // Find the closest triangle using the BVH of the mesh
+            // Note: The distance along the ray is the same in object space since the direction is not normalized
+            Ray objectRay(pObjectSpace, dObjectSpace, ray.tMin, tMax);
+            PrimitiveHit hit;
+            if (anyHit) {
+                hit.surface = shape.triangleBVH->anyTriangle(objectRay, hit.t);
+            } else {
+                hit.surface = shape.triangleBVH->closestTriangle(objectRay, hit.t);
+            }
+            if (hit.surface < 0) {
+                return PrimitiveHit();
+            }
+            return hit;
         }
     }
-    return isIntersect;
+
+    return PrimitiveHit();
 }
 
-void RayTracer::calculateLighting(const RayTraceScene &scene, glm::vec4 &cameraPos, glm::vec4 &d, float &t, glm::vec3 &normal, RenderShapeData &intersectShape, glm::vec4 &illumination) {
+// Compute the object space normal of a hit returned by intersectPrimitive
+glm::vec3 RayTracer::primitiveNormal(const RenderShapeData &shape, const Ray &ray, const PrimitiveHit &hit) {
+    PrimitiveFunction pf;
+    glm::vec4 pObjectSpace = shape.inverseCTM * ray.origin;    // Ray to Object Space
+    glm::vec4 dObjectSpace = shape.inverseCTM * ray.direction; // Ray to Object Space
+
+    switch (shape.primitive.type) {
+        case PrimitiveType::PRIMITIVE_CUBE:
+            return pf.cubeNormal(hit.surface);
+
+        case PrimitiveType::PRIMITIVE_CONE:
+            return pf.coneNormal(pObjectSpace, dObjectSpace, hit);
+
+        case PrimitiveType::PRIMITIVE_CYLINDER:
+            return pf.cylinderNormal(pObjectSpace, dObjectSpace, hit);
+
+        case PrimitiveType::PRIMITIVE_SPHERE:
+            return pf.sphereNormal(pObjectSpace, dObjectSpace, hit.t);
+
+        case PrimitiveType::PRIMITIVE_MESH:
+            return shape.triangleBVH->triangleNormal(hit.surface); // Precomputed when building the BVH
+    }
+
+    return glm::vec3(-1);
+}
+
+// Compute the texture and diffuse color at a hit
+// Note: These do not depend on the light, so they are looked up once per hit instead of once per light.
+template <unsigned Features>
+RayTracer::SurfaceInteraction RayTracer::calculateSurfaceInteraction(const RayTraceScene &scene, const Ray &ray, float t, const RenderShapeData &intersectShape) {
+    const glm::vec4 &cameraPos = ray.origin;
+    const glm::vec4 &d = ray.direction;
+    const SceneMaterial &material = intersectShape.primitive.material;
+
+    SurfaceInteraction surface;
+    // Texture
+    if ((Features & FEATURE_TEXTURE_MAP) && material.textureMap.isUsed && material.textureMap.image) {
+        glm::vec4 pObjectSpace = intersectShape.inverseCTM * cameraPos; // Ray to Object Space
+        glm::vec4 dObjectSpace = intersectShape.inverseCTM * d;         // Ray to Object Space
+        PrimitiveFunction pf;
+        if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_SPHERE) {
+            surface.textureColor = pf.sphereTexture(m_config.enableTextureFilter, pObjectSpace, dObjectSpace, t, material.textureMap.repeatU, material.textureMap.repeatV, *material.textureMap.image);
+        }
+        if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_CUBE) {
+            surface.textureColor = pf.cubeTexture(true, pObjectSpace, dObjectSpace, t, material.textureMap.repeatU, material.textureMap.repeatV, *material.textureMap.image);
+        }
+        if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_CYLINDER) {
+            surface.textureColor = pf.cylinderTexture(true, pObjectSpace, dObjectSpace, t, material.textureMap.repeatU, material.textureMap.repeatV, *material.textureMap.image);
+        }
+        if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_CONE) {
+            surface.textureColor = pf.coneTexture(m_config.enableTextureFilter, pObjectSpace, dObjectSpace, t, material.textureMap.repeatU, material.textureMap.repeatV, *material.textureMap.image);
+        }
+    }
+
+    // Diffuse color
+    surface.diffuseColor = scene.sceneMetaData.globalData.kd * material.cDiffuse;
+    if constexpr ((Features & FEATURE_TEXTURE_MAP) != 0) {
+        surface.diffuseColor = material.blend * glm::vec4(surface.textureColor, 1) + (1 - material.blend) * scene.sceneMetaData.globalData.kd * material.cDiffuse;
+    }
+    return surface;
+}
+
+// Add the ambient term and the light contributions at a hit to illumination
+// Note: If shadowRays is given, the shadow rays are not traced. Each one is appended with the contribution it adds if it
+//       is not occluded, so the caller can trace them in a batch.
+template <unsigned Features>
+void RayTracer::calculateLighting(const RayTraceScene &scene, const Ray &ray, float t, glm::vec3 &normal, const RenderShapeData &intersectShape, glm::vec4 &illumination, Sampler &sampler, std::vector<ShadowRay> *shadowRays) {
+    const glm::vec4 &cameraPos = ray.origin;
+    const glm::vec4 &d = ray.direction;
     glm::vec3 directionToCamera = -d;
     directionToCamera = glm::normalize(directionToCamera);
-    SceneMaterial material = intersectShape.primitive.material;
+    const SceneMaterial &material = intersectShape.primitive.material;
 
     // Check whether normal direction is pointing to camera
     float checkNormal = glm::dot(normal, directionToCamera);
     if (checkNormal < 0) {
         normal = -normal;
     }
+    if constexpr ((Features & FEATURE_NORMALS) != 0) {
+        return; // Only the oriented normal is rendered
+    }
 
     glm::vec4 intersectPos = cameraPos + t * d;
 
     // Ambient term
     illumination += scene.sceneMetaData.globalData.ka *  material.cAmbient;
 
-    for (SceneLightData light : scene.sceneMetaData.lights) {
+    const SurfaceInteraction surface = calculateSurfaceInteraction<Features>(scene, ray, t, intersectShape);
+
+    for (const SceneLightData &light : scene.sceneMetaData.lights) {
         glm::vec4 color = light.color;
         float distanceToLight;
         float att;
@@ -483,34 +1019,10 @@ void RayTracer::calculateLighting(const RayTraceScene &scene, glm::vec4 &cameraP
                 }
                 break;
         }
-        // Texture
-        glm::vec3 textureColor = {0,0,0};
-        if (m_config.enableTextureMap && material.textureMap.isUsed) {
-            glm::mat4 ctm = intersectShape.ctm;
-            glm::vec4 pObjectSpace = glm::inverse(ctm) * cameraPos; // Ray to Object Space
-            glm::vec4 dObjectSpace = glm::inverse(ctm) * d;         // Ray to Object Space
-            PrimitiveFunction pf;
-            if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_SPHERE) {
-                textureColor = pf.sphereTexture(m_config.enableTextureFilter, pObjectSpace, dObjectSpace, t, material.textureMap.repeatU, material.textureMap.repeatV, QString::fromStdString(material.textureMap.filename));
-            }
-            if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_CUBE) {
-                textureColor = pf.cubeTexture(true, pObjectSpace, dObjectSpace, t, material.textureMap.repeatU, material.textureMap.repeatV, QString::fromStdString(material.textureMap.filename));
-            }
-            if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_CYLINDER) {
-                textureColor = pf.cylinderTexture(true, pObjectSpace, dObjectSpace, t, material.textureMap.repeatU, material.textureMap.repeatV, QString::fromStdString(material.textureMap.filename));
-            }
-            if (intersectShape.primitive.type == PrimitiveType::PRIMITIVE_CONE) {
-                textureColor = pf.coneTexture(m_config.enableTextureFilter, pObjectSpace, dObjectSpace, t, material.textureMap.repeatU, material.textureMap.repeatV, QString::fromStdString(material.textureMap.filename));
-            }
-        }
-
         // Diffuse term
         float diffuseDot = glm::dot(normal, Li);
         float diffuseClamped = glm::clamp(diffuseDot, 0.0f, 1.0f);
-        glm::vec4 diffuseTerm = scene.sceneMetaData.globalData.kd * material.cDiffuse * diffuseClamped;
-        if (m_config.enableTextureMap) {
-            diffuseTerm =  (material.blend * glm::vec4(textureColor, 1) + (1 - material.blend) * scene.sceneMetaData.globalData.kd * material.cDiffuse) * diffuseClamped;
-        }
+        glm::vec4 diffuseTerm = surface.diffuseColor * diffuseClamped;
 
         // Specular term
         glm::vec3 r = 2 * glm::dot(Li, normal) * normal - Li;
@@ -521,8 +1033,7 @@ void RayTracer::calculateLighting(const RayTraceScene &scene, glm::vec4 &cameraP
         // Calculate shadow
         bool isShadowIntersect = false;
         float softShadowFactor = 1.0f;  // default to no shadow
-        bool enableSoftShadow = true; // TODO: Debug the flag handler!
-        if (m_config.enableShadow) {
+        if constexpr ((Features & FEATURE_SHADOW) != 0) {
             intersectPos = cameraPos + (t - 0.01f) * d; // Avoid self-intersection
 
             glm::vec4 directionToLight;
@@ -534,58 +1045,66 @@ void RayTracer::calculateLighting(const RayTraceScene &scene, glm::vec4 &cameraP
             }
             directionToLight = glm::normalize(directionToLight);
 
-//            std::cout << m_config.enableSoftShadows << std::endl;
             // If soft shadow is enabled, trace ray to light on a finite area instead of a point.
             // Note: This is only available for point light and spot light. Direcectional light has infinite area.
-            if (enableSoftShadow && light.type != LightType::LIGHT_DIRECTIONAL) {
-                int numSamples = 20; // Adjust as needed
+            if (m_config.enableSoftShadows && light.type != LightType::LIGHT_DIRECTIONAL) {
+                glm::vec3 contribution = att * color.xyz() * (diffuseTerm.xyz() + specularTerm.xyz()) * (1-falloff);
+
+                // Shadow ray to a random point in the cell (cellX, cellY) of a grid of cells x cells on the light area
+                auto lightSampleRay = [&](int cellX, int cellY, int cells) {
+                    float u = (cellX + sampler.nextFloat()) / cells - 0.5f;
+                    float v = (cellY + sampler.nextFloat()) / cells - 0.5f;
+                    glm::vec4 lightSamplePoint = light.pos + glm::vec4(u * light.width, v * light.height, 0, 0);
+
+                    // Note: Only occluders between the point and the light sample block the light
+                    float distanceToSample = glm::length(lightSamplePoint - intersectPos);
+                    return Ray(intersectPos, glm::normalize(lightSamplePoint - intersectPos), 0, distanceToSample);
+                };
+
+                // Adaptive sampling
+                // Note: One probe ray is traced to each quadrant of the light first. If the probes agree, the point is
+                //       fully lit or fully in shadow and no more rays are traced. Otherwise the rest of the budget is spent
+                //       on a stratified grid over the light, and all samples are averaged. The probes are traced at once
+                //       even if the shadow rays are deferred, only the rays of the grid are deferred.
+                const int PROBES_PER_AXIS = 2;
+                const int numProbes = PROBES_PER_AXIS * PROBES_PER_AXIS;
                 int unobstructedCount = 0;
-
-                for (int sample = 0; sample < numSamples; ++sample) {
-                    float halfWidth = 0.25; // Adjust as needed
-                    float halfHeight = 0.25; // Adjust as needed
-
-                    glm::vec4 randomOffset((static_cast<float>(rand()) / RAND_MAX - 0.5) * 2 * halfWidth,
-                                           (static_cast<float>(rand()) / RAND_MAX - 0.5) * 2 * halfHeight, 0, 0);
-                    glm::vec4 lightSamplePoint = light.pos + randomOffset;
-                    directionToLight = glm::normalize(lightSamplePoint - intersectPos);
-
-                    float shadowT = 1000; // used to track the nearest intersection
-                    glm::vec3 shadowIntersectNormal{-1, -1, -1};
-                    RenderShapeData shadowIntersectShape; // The intersected shape that used to calculate lighting
-
-                    bool currentShadowIntersect;
-                    if (m_config.enableAcceleration) {
-                        std::vector<RenderShapeData> potentialShadowIntersectShapes = m_bvh->potentialIntersections(intersectPos, directionToLight); // BVH version
-                        currentShadowIntersect = calculateIntersection(potentialShadowIntersectShapes, intersectPos, directionToLight, shadowT, shadowIntersectNormal, shadowIntersectShape);
-                    } else {
-                        std::vector<RenderShapeData> potentialShadowIntersectShapes = scene.sceneMetaData.shapes;
-                        currentShadowIntersect = calculateIntersection(potentialShadowIntersectShapes, intersectPos, directionToLight, shadowT, shadowIntersectNormal, shadowIntersectShape);
-                    }
-
-                    if (!currentShadowIntersect) {
+                for (int probe = 0; probe < numProbes; probe++) {
+                    if (!isOccluded<Features>(scene, lightSampleRay(probe % PROBES_PER_AXIS, probe / PROBES_PER_AXIS, PROBES_PER_AXIS))) {
                         unobstructedCount++;
                     }
                 }
 
+                int numSamples = numProbes;
+                if (unobstructedCount > 0 && unobstructedCount < numProbes) {
+                    const int samplesPerAxis = static_cast<int>(std::sqrt(std::max(m_config.softShadowMaxSamples - numProbes, 0)));
+                    numSamples += samplesPerAxis * samplesPerAxis;
+                    for (int sample = 0; sample < samplesPerAxis * samplesPerAxis; sample++) {
+                        Ray shadowRay = lightSampleRay(sample % samplesPerAxis, sample / samplesPerAxis, samplesPerAxis);
+                        if (shadowRays) {
+                            shadowRays->push_back({shadowRay, contribution / static_cast<float>(numSamples), -1});
+                        }
+                        else if (!isOccluded<Features>(scene, shadowRay)) {
+                            unobstructedCount++;
+                        }
+                    }
+                }
                 softShadowFactor = static_cast<float>(unobstructedCount) / numSamples;
 
-                illumination.x += softShadowFactor * att * color.x * (diffuseTerm.x + specularTerm.x) * (1-falloff);
-                illumination.y += softShadowFactor * att * color.y * (diffuseTerm.y + specularTerm.y) * (1-falloff);
-                illumination.z += softShadowFactor * att * color.z * (diffuseTerm.z + specularTerm.z) * (1-falloff);
+                illumination.x += softShadowFactor * contribution.x;
+                illumination.y += softShadowFactor * contribution.y;
+                illumination.z += softShadowFactor * contribution.z;
 
             } else {
-                float shadowT = 1000; // used to track the nearest intersection
-                glm::vec3 shadowIntersectNormal{-1, -1, -1};
-                RenderShapeData shadowIntersectShape; // The intersected shape that used to calculate lighting
-
-                if (m_config.enableAcceleration) {
-                    std::vector<RenderShapeData> potentialShadowIntersectShapes = m_bvh->potentialIntersections(intersectPos, directionToLight); // BVH version
-                    isShadowIntersect = calculateIntersection(potentialShadowIntersectShapes, intersectPos, directionToLight, shadowT, shadowIntersectNormal, shadowIntersectShape);
-                } else {
-                    std::vector<RenderShapeData> potentialShadowIntersectShapes = scene.sceneMetaData.shapes;
-                    isShadowIntersect = calculateIntersection(potentialShadowIntersectShapes, intersectPos, directionToLight, shadowT, shadowIntersectNormal, shadowIntersectShape);
+                // Note: Only occluders between the point and the light block the light, directional lights are bounded by the scene
+                float shadowTMax = light.type == LightType::LIGHT_DIRECTIONAL ? MAX_RAY_DISTANCE : glm::length(light.pos - intersectPos);
+                Ray shadowRay(intersectPos, directionToLight, 0, shadowTMax);
+                if (shadowRays) {
+                    glm::vec3 contribution = att * color.xyz() * (diffuseTerm.xyz() + specularTerm.xyz()) * (1-falloff);
+                    shadowRays->push_back({shadowRay, contribution, -1});
+                    continue;
                 }
+                isShadowIntersect = isOccluded<Features>(scene, shadowRay);
 
                 illumination.x += !isShadowIntersect * att * color.x * (diffuseTerm.x + specularTerm.x) * (1-falloff);
                 illumination.y += !isShadowIntersect * att * color.y * (diffuseTerm.y + specularTerm.y) * (1-falloff);
@@ -1,11 +1,10 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <QQueue>
-#include <QPair>
-#include <QMutex>
-#include <QMutexLocker>
+#include <utility>
 #include "utils/rgba.h"
+#include "utils/ray.h"
+#include "utils/sampler.h"
 #include "primitive/primitivefunction.h"
 #include "acceleration/BVH.h"
 #include "antialias/filter.h"
@@ -15,10 +14,6 @@
 // A forward declaration for the RaytraceScene class
 class RayTraceScene;
 
-// These will allow access to the global task queue and mutex from other parts of the code.
-extern QQueue<QPair<int, int>> taskQueue;
-extern QMutex taskQueueMutex;
-
 // A class representing a ray-tracer
 class RayTracer
 {
@@ -36,6 +31,29 @@ public:
         int maxRecursiveDepth    = 4;
         bool onlyRenderNormals   = false;
         bool enableSoftShadows    = true;
+        int softShadowMaxSamples = 20;   // Maximum shadow rays per light and hit, of which 4 are probes
+        float minThroughput      = 0.01f; // Throughput below which reflected and refracted rays are continued by Russian roulette
+        int numThreads           = 0;    // 0 uses QThread::idealThreadCount()
+        int blockSize            = 32;   // Side length of a parallel render block in pixels, at least 1
+        bool enableCenterFirst   = true; // Render blocks near the image center first
+        bool enableSAH           = true; // Build the BVHs with the surface area heuristic instead of median splits
+        int bvhMaxLeafSize       = 8;    // Maximum number of primitives in a BVH leaf
+        int bvhWidth             = 4;    // Number of children of a BVH node: 2, 4 or 8
+        bool enableRayPackets    = true; // Trace primary rays in packets of 4x4 pixels
+        bool enableWavefront     = false; // Trace the rays of a render block bounce by bounce in sorted batches
+        float superSampleThreshold = 0.1f; // Summed color distance of the corners above which a super-sampled square is split
+        int superSampleMaxDepth  = 1;    // Maximum number of times a super-sampled pixel is split into 4 squares, 0 to 8
+        int adaptiveMinSamples   = 4;    // Samples per pixel before adaptive sampling (depth of field) may stop, 1 to adaptiveMaxSamples
+        int adaptiveMaxSamples   = 16;   // Maximum samples per pixel of adaptive sampling, at least 1
+        float adaptiveTolerance  = 0.02f; // Half width of the 95% confidence interval of the pixel luminance to stop at
+    };
+
+    // A rectangular block of pixels [startX, endX) x [startY, endY)
+    struct RenderBlock {
+        int startX;
+        int startY;
+        int endX;
+        int endY;
     };
 
 public:
@@ -48,22 +66,114 @@ public:
     // @param scene The scene to be rendered.
     void render(RGBA *imageData, RayTraceScene &scene);
 
+    // Number of samples that were traced for each pixel of the last render, in the same layout as the image
+    const std::vector<int> &sampleCounts() const { return m_sampleCounts; }
+
 private:
     const Config m_config;
+    std::vector<int> m_sampleCounts;
+
+    // Config flags which are checked for every ray or light in the render functions
+    // Note: The render functions are compiled for every combination of these flags and the config selects the
+    //       instantiation once per render, so the flags are constants in the inner loops.
+    enum RenderFeature : unsigned {
+        FEATURE_ACCELERATION = 1u << 0,
+        FEATURE_SHADOW       = 1u << 1,
+        FEATURE_TEXTURE_MAP  = 1u << 2,
+        FEATURE_NORMALS      = 1u << 3,  // Only render normals
+        FEATURE_COMBINATIONS = 1u << 4
+    };
+    using RenderBlockFunction = void (RayTracer::*)(RGBA*, const RayTraceScene&, int, int, int, int);
+    unsigned renderFeatures() const;
+    template <size_t... Features>
+    static RenderBlockFunction selectRenderBlock(unsigned features, std::index_sequence<Features...>);
+
+    // A ray of the wavefront integrator, its color is added to a pixel scaled by weight
+    // Note: path numbers the rays of a pixel like a binary heap (primary ray 1, reflected 2 * path, refracted
+    //       2 * path + 1), it seeds the sampler of the hit so the samples do not depend on the order of the rays.
+    struct WavefrontRay {
+        Ray ray;
+        glm::vec3 weight;
+        int pixel;
+        uint32_t path;
+    };
+
+    // Running mean of the samples of a pixel and variance of their luminance (Welford's algorithm)
+    struct PixelEstimate {
+        glm::vec4 mean = glm::vec4(0);
+        float luminanceMean = 0;
+        float luminanceM2 = 0;
+        int count = 0;
+
+        void add(const glm::vec4 &sample);
+        // Half width of the 95% confidence interval of the mean luminance
+        float confidence() const;
+    };
+
+    // Properties of the surface at a hit that are the same for all lights, so they are computed once per hit
+    struct SurfaceInteraction {
+        glm::vec3 textureColor = glm::vec3(0); // Filtered texel at the hit, black without a texture
+        glm::vec4 diffuseColor;                 // Diffuse reflectance with the texture blended in
+    };
+
+    // A ray of the ray tree of a pixel, its color is added scaled by throughput
+    struct PathRay {
+        Ray ray;
+        glm::vec3 throughput;
+        int recursionDepth;
+    };
+
+    // A deferred shadow ray, the contribution is added to a pixel if the ray is not occluded
+    struct ShadowRay {
+        Ray ray;
+        glm::vec3 contribution;
+        int pixel;
+    };
 
     void renderSegment(RGBA* imageData, const RayTraceScene& scene, int startRow, int endRow);
+    template <unsigned Features>
     void renderBlock(RGBA* imageData, const RayTraceScene& scene, int startX, int startY, int endX, int endY);
+    template <unsigned Features>
+    void renderBlockSuperSample(RGBA* imageData, const RayTraceScene& scene, int startX, int startY, int endX, int endY);
+    template <unsigned Features>
+    glm::vec4 traceSuperSample(const RayTraceScene& scene, float x, float y);
+    template <unsigned Features>
+    glm::vec4 refineSuperSample(const RayTraceScene& scene, float x, float y, float size, const glm::vec4 corners[4], int depth, int &sampleCount);
+    template <unsigned Features>
+    void renderBlockPackets(RGBA* imageData, const RayTraceScene& scene, int startX, int startY, int endX, int endY);
+    template <unsigned Features>
+    void renderBlockWavefront(RGBA* imageData, const RayTraceScene& scene, int startX, int startY, int endX, int endY);
+    static void sortWavefront(const std::vector<WavefrontRay> &rays, std::vector<uint64_t> &order);
+    template <unsigned Features>
+    void traceWavefront(const RayTraceScene& scene, const std::vector<WavefrontRay> &rays, const std::vector<uint64_t> &order, std::vector<Hit> &hits);
+    void writePixel(RGBA* imageData, const RayTraceScene& scene, int i, int j, const glm::vec4 &illumination);
 
 //    glm::vec3 computeRayColor(const RayTraceScene& scene, float i, float j);
-    glm::vec4 computeRayColor(const RayTraceScene& scene, std::vector<glm::vec4> ray, int recursionDepth);
-    std::vector<glm::vec4> calculateRayInfo(const RayTraceScene& scene, float i, float j);
-    bool calculateIntersection(std::vector<RenderShapeData> &shapes, glm::vec4 &cameraPos, glm::vec4 &d, float &t, glm::vec3 &normal, RenderShapeData &intersectShape);
-    void calculateLighting(const RayTraceScene &scene, glm::vec4 &cameraPos, glm::vec4 &d, float &t, glm::vec3 &normal, RenderShapeData &intersectShape, glm::vec4 &illumination);
+    template <unsigned Features>
+    glm::vec4 computeRayColor(const RayTraceScene& scene, const Ray &ray, int recursionDepth, Sampler &sampler);
+    template <unsigned Features>
+    glm::vec4 computeRayColor(const RayTraceScene& scene, const Ray &ray, const Hit &hit, int recursionDepth, Sampler &sampler);
+    bool continuePath(glm::vec3 &throughput, Sampler &sampler);
+    Ray calculateRayInfo(const RayTraceScene& scene, float i, float j, Sampler &sampler);
+    template <unsigned Features>
+    bool calculateIntersection(const RayTraceScene &scene, const Ray &ray, Hit &hit);
+    void calculatePacketIntersection(const RayTraceScene &scene, const RayPacket &packet, Hit hits[]);
+    template <unsigned Features>
+    bool isOccluded(const RayTraceScene &scene, const Ray &ray);
+    PrimitiveHit intersectPrimitive(const RenderShapeData &shape, const Ray &ray, float tMax, bool anyHit = false);
+    glm::vec3 primitiveNormal(const RenderShapeData &shape, const Ray &ray, const PrimitiveHit &hit);
+    glm::vec3 worldNormal(const RenderShapeData &shape, const Ray &ray, const PrimitiveHit &hit);
+    template <unsigned Features>
+    SurfaceInteraction calculateSurfaceInteraction(const RayTraceScene &scene, const Ray &ray, float t, const RenderShapeData &intersectShape);
+    template <unsigned Features>
+    void calculateLighting(const RayTraceScene &scene, const Ray &ray, float t, glm::vec3 &normal, const RenderShapeData &intersectShape, glm::vec4 &illumination, Sampler &sampler, std::vector<ShadowRay> *shadowRays = nullptr);
     void mapNormalColor(glm::vec3 inColor, glm::vec3 &outColor);
     void mapIlluminationColor(glm::vec3 inColor, glm::vec3 &outColor);
 
     std::vector<RGBA> loadImage(const QString &filePath, int &width, int &height);
 
+    Ray calculateReflectRay(const glm::vec4 &intersectPos, const glm::vec4 &d, const glm::vec3 &normal);
+    Ray calculateRefractRay(const glm::vec4 &intersectPosIn, const glm::vec4 &d, const glm::vec3 &normal, const RenderShapeData &intersectShape);
     glm::vec4 refractDirection(const glm::vec4& d, const glm::vec3& normal, float ior);
 };
 
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cmath>
+
+// A ray in homogeneous coordinates which is valid within [tMin, tMax]
+// Note: The reciprocal of the direction and its signs are precomputed once per ray for the slab tests of BVH traversal.
+//       The direction is not necessarily normalized, so t is preserved when the ray is transformed to object space.
+struct Ray {
+    glm::vec4 origin;        // Point (w = 1)
+    glm::vec4 direction;     // Vector (w = 0)
+    glm::vec3 invDirection;  // 1 / direction, infinite for a zero component
+    int sign[3];             // 1 where invDirection is negative (including 1 / -0), the max plane of a box is hit first
+    float tMin;
+    float tMax;
+
+    Ray() = default;
+    Ray(const glm::vec4 &origin, const glm::vec4 &direction, float tMin = 0, float tMax = INFINITY) :
+        origin(origin), direction(direction), invDirection(1.0f / glm::vec3(direction)), tMin(tMin), tMax(tMax) {
+        sign[0] = invDirection.x < 0;
+        sign[1] = invDirection.y < 0;
+        sign[2] = invDirection.z < 0;
+    }
+
+    // Point on the ray at distance t
+    glm::vec4 at(float t) const {
+        return origin + t * direction;
+    }
+};
+
+// The closest intersection of a ray
+struct Hit {
+    int shapeIndex = -1;                  // Index into the shape list of the scene
+    float t = 0;                          // Distance along the ray
+    glm::vec3 normal = glm::vec3(-1);     // Normalized normal in world space
+};
+
+// Maximum number of rays in a packet (a 4x4 pixel tile of primary rays)
+static const int RAY_PACKET_SIZE = 16;
+
+// Coherent rays which traverse the BVH together
+struct RayPacket {
+    Ray rays[RAY_PACKET_SIZE];
+    int size = 0;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+
+// A small random number generator (PCG32) for the random samples of soft shadows and depth of field
+// Note: A generator is seeded from the pixel it renders and a sequence index instead of sharing one global state, so
+//       threads do not contend for it and images do not depend on the number of threads or the order of the blocks.
+class Sampler {
+public:
+    Sampler(uint32_t x, uint32_t y, uint32_t sequence = 0) {
+        // Note: The coordinates are mixed (splitmix64) so that neighboring pixels start far apart in the sequence
+        uint64_t seed = (static_cast<uint64_t>(y) << 32) | x;
+        seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ull;
+        seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebull;
+        seed ^= seed >> 31;
+
+        m_state = 0;
+        m_increment = (static_cast<uint64_t>(sequence) << 1) | 1;
+        nextUInt();
+        m_state += seed;
+        nextUInt();
+    }
+
+    // Uniformly distributed 32 bit integer
+    uint32_t nextUInt() {
+        uint64_t state = m_state;
+        m_state = state * 6364136223846793005ull + m_increment;
+        uint32_t xorShifted = static_cast<uint32_t>(((state >> 18) ^ state) >> 27);
+        uint32_t rotation = static_cast<uint32_t>(state >> 59);
+        return (xorShifted >> rotation) | (xorShifted << ((-rotation) & 31));
+    }
+
+    // Uniformly distributed float in [0, 1)
+    float nextFloat() {
+        return (nextUInt() >> 8) * 0x1p-24f;
+    }
+
+private:
+    uint64_t m_state;
+    uint64_t m_increment;
+};
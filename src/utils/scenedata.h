@@ -2,9 +2,12 @@
 
 #include <vector>
 #include <string>
+#include <memory>
 
 #include <glm/glm.hpp>
 
+struct ImageData;
+
 // Enum of the types of virtual lights that might be in the scene
 enum class LightType {
     LIGHT_POINT,
@@ -53,7 +56,7 @@ struct SceneLight {
     float penumbra; // Only applicable to spot lights, in RADIANS
     float angle;    // Only applicable to spot lights, in RADIANS
 
-    float width, height; // No longer supported (area lights)
+    float width, height; // Size of the light area sampled by soft shadows, only applicable to point and spot lights
 };
 
 // Struct which contains data for a single light with CTM applied
@@ -70,7 +73,7 @@ struct SceneLightData {
     float penumbra; // Only applicable to spot lights, in RADIANS
     float angle;    // Only applicable to spot lights, in RADIANS
 
-    float width, height; // No longer supported (area lights)
+    float width, height; // Size of the light area sampled by soft shadows, only applicable to point and spot lights
 };
 
 // Struct which contains data for the camera of a scene
@@ -95,12 +98,15 @@ struct SceneFileMap {
     float repeatU;
     float repeatV;
 
+    std::shared_ptr<const ImageData> image; // Loaded image, set up before rendering
+
     void clear()
     {
         isUsed = false;
         repeatU = 0.0f;
         repeatV = 0.0f;
         filename = std::string();
+        image = nullptr;
     }
 };
 
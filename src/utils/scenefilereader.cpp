@@ -204,7 +204,7 @@ bool ScenefileReader::parseGlobalData(const QJsonObject &globalData) {
  */
 bool ScenefileReader::parseLightData(const QJsonObject &lightData, SceneNode *node) {
     QStringList requiredFields = {"type", "color"};
-    QStringList optionalFields = {"name", "attenuationCoeff", "direction", "penumbra", "angle"};
+    QStringList optionalFields = {"name", "attenuationCoeff", "direction", "penumbra", "angle", "width", "height"};
     QStringList allFields = requiredFields + optionalFields;
     for (auto &field : lightData.keys()) {
         if (!allFields.contains(field)) {
@@ -226,6 +226,24 @@ bool ScenefileReader::parseLightData(const QJsonObject &lightData, SceneNode *no
 
     light->dir = glm::vec4(0.f, 0.f, 0.f, 0.f);
     light->function = glm::vec3(1, 0, 0);
+    light->width = 0.5f;
+    light->height = 0.5f;
+
+    // parse the size of the light area (optional, sampled by soft shadows)
+    if (lightData.contains("width")) {
+        if (!lightData["width"].isDouble() || lightData["width"].toDouble() < 0) {
+            std::cout << "light width must be a non-negative float" << std::endl;
+            return false;
+        }
+        light->width = lightData["width"].toDouble();
+    }
+    if (lightData.contains("height")) {
+        if (!lightData["height"].isDouble() || lightData["height"].toDouble() < 0) {
+            std::cout << "light height must be a non-negative float" << std::endl;
+            return false;
+        }
+        light->height = lightData["height"].toDouble();
+    }
 
     // parse the color
     if (!lightData["color"].isArray()) {
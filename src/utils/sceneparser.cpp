@@ -64,6 +64,8 @@ void SceneParser::dfsParse(SceneNode* node, std::vector<RenderShapeData>& shapes
             renderNode.primitive.material = primitive->material;
             renderNode.primitive.meshfile = primitive->meshfile;
             renderNode.ctm = ctm;
+            renderNode.inverseCTM = glm::inverse(ctm);
+            renderNode.normalMatrix = glm::inverse(glm::transpose(glm::mat3(ctm)));
 
             shapes.push_back(renderNode);
         }
@@ -81,6 +83,8 @@ void SceneParser::dfsParse(SceneNode* node, std::vector<RenderShapeData>& shapes
             case LightType::LIGHT_POINT:
                 // Update using ctm
                 sceneLight.pos = ctm * glm::vec4(0,0,0,1);
+                sceneLight.width = light->width;
+                sceneLight.height = light->height;
                 break;
 
             case LightType::LIGHT_DIRECTIONAL:
@@ -94,6 +98,8 @@ void SceneParser::dfsParse(SceneNode* node, std::vector<RenderShapeData>& shapes
                 sceneLight.dir = ctm * light->dir;
                 sceneLight.penumbra = light->penumbra;
                 sceneLight.angle = light->angle;
+                sceneLight.width = light->width;
+                sceneLight.height = light->height;
                 break;
             }
 
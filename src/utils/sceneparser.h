@@ -4,14 +4,19 @@
 //#include "acceleration/BVH.h"
 #include <vector>
 #include <string>
+#include <memory>
 
 class BVH;
+class Mesh;
 
 // Struct which contains data for a single primitive, to be used for rendering
 struct RenderShapeData {
     ScenePrimitive primitive;
     glm::mat4 ctm; // the cumulative transformation matrix
-    std::shared_ptr<BVH> triangleBVH; // BVH tree for triangles if the primitive is a mesh
+    glm::mat4 inverseCTM;   // World space to object space, precomputed from ctm
+    glm::mat3 normalMatrix; // Inverse transpose of the upper-left 3x3 of ctm, maps object space normals to world space
+    std::shared_ptr<const Mesh> mesh; // Shared mesh data from MeshCache if the primitive is a mesh
+    std::shared_ptr<const BVH> triangleBVH; // BVH tree for triangles if the primitive is a mesh, shared by all instances of the mesh
 };
 
 // Struct which contains all the data needed to render a scene
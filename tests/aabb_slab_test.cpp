@@ -0,0 +1,123 @@
+// Regression test for the slab tests of the wide BVH with axis-aligned rays
+// Note: A direction component that is exactly 0 (or -0) gives an infinite reciprocal, and a ray that starts on a plane
+//       of a box gives 0 * inf = NaN there. Boxes that such a ray touches must not be culled, and the scalar, SSE and
+//       AVX2 kernels must agree with each other and with the single-box test.
+
+#include "acceleration/AABBSoA.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+// Exact test of the closed segment [0, tMax] of an axis-aligned ray against a closed box with integer bounds
+static bool touches(const AABB& box, const glm::vec3& origin, const glm::vec3& direction, float tMax) {
+    float tNear = 0;
+    float tFar = tMax;
+    for (int k = 0; k < 3; k++) {
+        if (direction[k] == 0) {
+            if (origin[k] < box.minBounds[k] || origin[k] > box.maxBounds[k]) {
+                return false;
+            }
+        } else {
+            float t0 = (box.minBounds[k] - origin[k]) / direction[k];
+            float t1 = (box.maxBounds[k] - origin[k]) / direction[k];
+            tNear = std::max(tNear, std::min(t0, t1));
+            tFar = std::min(tFar, std::max(t0, t1));
+        }
+    }
+    return tNear <= tFar;
+}
+
+// Only the first failures are printed
+static const int MAX_REPORTED_FAILURES = 10;
+static int reportedFailures = 0;
+
+static bool supported(SIMDLevel level) {
+    return static_cast<int>(level) <= static_cast<int>(activeSIMDLevel());
+}
+
+// Test one ray against N boxes with every kernel the CPU supports and count the failures
+template <int N>
+static int checkBoxes(const AABB boxes[N], const Ray& ray) {
+    AABBSoA<N> soa;
+    for (int i = 0; i < N; i++) {
+        soa.set(i, boxes[i]);
+    }
+
+    int failures = 0;
+    const SIMDLevel levels[] = {SIMDLevel::Scalar, SIMDLevel::SSE42, SIMDLevel::AVX2};
+    for (SIMDLevel level : levels) {
+        if (!supported(level)) {
+            continue;
+        }
+
+        float tEntry[N];
+        int mask;
+        if constexpr (N == 4) {
+            mask = intersectAABB4(level, soa, ray, ray.tMax, tEntry);
+        } else {
+            mask = intersectAABB8(level, soa, ray, ray.tMax, tEntry);
+        }
+        for (int i = 0; i < N; i++) {
+            bool hit = mask & (1 << i);
+            float tSingle;
+            bool single = intersectAABB(boxes[i], ray, ray.tMax, tSingle);
+            bool touch = touches(boxes[i], glm::vec3(ray.origin), glm::vec3(ray.direction), ray.tMax);
+
+            if (hit != touch || hit != single || (hit && tEntry[i] != tSingle)) {
+                if (reportedFailures++ < MAX_REPORTED_FAILURES) {
+                    std::printf("%s kernel, %d boxes: box (%g %g %g)-(%g %g %g), ray (%g %g %g) dir (%g %g %g): "
+                                "hit %d, single-box test %d, expected %d\n",
+                                simdLevelName(level), N,
+                                boxes[i].minBounds.x, boxes[i].minBounds.y, boxes[i].minBounds.z,
+                                boxes[i].maxBounds.x, boxes[i].maxBounds.y, boxes[i].maxBounds.z,
+                                ray.origin.x, ray.origin.y, ray.origin.z,
+                                ray.direction.x, ray.direction.y, ray.direction.z,
+                                hit, single, touch);
+                }
+                failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+int main() {
+    std::printf("Kernels up to %s\n", simdLevelName(activeSIMDLevel()));
+
+    // Boxes with integer bounds and rays along the axes with integer origins, so that many rays start on a plane
+    // of a box or slide along one of its faces
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<int> coordinate(-4, 4);
+    auto randomPoint = [&]() {
+        return glm::vec3(coordinate(rng), coordinate(rng), coordinate(rng));
+    };
+
+    int failures = 0;
+    int tests = 0;
+    for (int i = 0; i < 60000; i++) {
+        AABB boxes[8];
+        for (AABB& box : boxes) {
+            glm::vec3 a = randomPoint();
+            glm::vec3 b = randomPoint();
+            box.minBounds = glm::min(a, b);
+            box.maxBounds = glm::max(a, b);
+        }
+
+        // Cycle through the axis, the direction along it and the sign of the zero components
+        int axis = i % 3;
+        bool negative = (i / 3) % 2;
+        bool negativeZero = (i / 6) % 2;
+        glm::vec4 direction(negativeZero ? -0.0f : 0.0f);
+        direction.w = 0;
+        direction[axis] = negative ? -1.0f : 1.0f;
+
+        Ray ray(glm::vec4(randomPoint(), 1), direction, 0, 100);
+        failures += checkBoxes<4>(boxes, ray);
+        failures += checkBoxes<8>(boxes, ray);
+        tests += 12;
+    }
+
+    std::printf("%d box tests per kernel, %d failures\n", tests, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+// Test that rendering a pixel does not allocate heap memory in steady state
+// Note: Global operator new is replaced by a counting one. RayTracer::render builds the BVHs and a few buffers of the
+//       image size on every call, which is a fixed number of allocations. After a warm-up render has grown the
+//       per-thread buffers of the ray tree and the shadow rays, rendering the scene at twice the resolution must
+//       therefore allocate exactly as often as rendering it at the original resolution.
+
+#include "raytracer/raytracer.h"
+#include "raytracer/raytracescene.h"
+
+#include <glm/gtx/transform.hpp>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<long> allocationCount{0};
+
+void* operator new(std::size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+static SceneMaterial material(const glm::vec4& diffuse, const glm::vec4& reflective, const glm::vec4& transparent) {
+    SceneMaterial m;
+    m.clear();
+    m.cAmbient = diffuse * 0.3f;
+    m.cDiffuse = diffuse;
+    m.cSpecular = glm::vec4(1);
+    m.shininess = 15;
+    m.cReflective = reflective;
+    m.cTransparent = transparent;
+    m.ior = 1.5f;
+    return m;
+}
+
+static void addShape(RenderData& data, PrimitiveType type, const glm::mat4& ctm, const SceneMaterial& m, const std::string& meshfile = "") {
+    RenderShapeData shape;
+    shape.primitive.type = type;
+    shape.primitive.material = m;
+    shape.primitive.meshfile = meshfile;
+    shape.ctm = ctm;
+    shape.inverseCTM = glm::inverse(ctm);
+    shape.normalMatrix = glm::inverse(glm::transpose(glm::mat3(ctm)));
+    data.shapes.push_back(shape);
+}
+
+// Every primitive type with reflective and transparent materials, lit by a point, a directional and a spot light
+static RenderData testScene() {
+    RenderData data;
+    data.globalData = {0.5f, 0.5f, 0.5f, 0.5f};
+    data.cameraData.pos = glm::vec4(-6, 4, 4, 1);
+    data.cameraData.look = glm::vec4(6, -4, -4, 0);
+    data.cameraData.up = glm::vec4(0, 1, 0, 0);
+    data.cameraData.heightAngle = glm::radians(30.0f);
+    data.cameraData.aperture = 0.05f;
+    data.cameraData.focalLength = 1.0f;
+
+    const glm::vec4 none(0);
+    addShape(data, PrimitiveType::PRIMITIVE_CYLINDER, glm::translate(glm::vec3(-0.65, 0, 0.65)), material({0.8, 0.6, 0.6, 1}, none, glm::vec4(0.4f)));
+    addShape(data, PrimitiveType::PRIMITIVE_CONE, glm::translate(glm::vec3(-0.65, 0, -0.65)), material({0.6, 0.6, 0.8, 1}, none, none));
+    addShape(data, PrimitiveType::PRIMITIVE_SPHERE, glm::translate(glm::vec3(0.65, 0, -0.65)), material({0.6, 0.8, 0.6, 1}, glm::vec4(0.3f), glm::vec4(0.6f)));
+    addShape(data, PrimitiveType::PRIMITIVE_CUBE, glm::translate(glm::vec3(0.65, 0, 0.65)), material({0.8, 0.8, 0.5, 1}, none, none));
+    addShape(data, PrimitiveType::PRIMITIVE_CUBE, glm::translate(glm::vec3(0, -0.75, 0)) * glm::scale(glm::vec3(4, 0.5, 4)), material({0.5, 0.5, 0.5, 1}, glm::vec4(0.5f), none));
+    addShape(data, PrimitiveType::PRIMITIVE_MESH, glm::translate(glm::vec3(0, 0.8, 0)) * glm::scale(glm::vec3(4)), material({0.9, 0.7, 0.3, 1}, none, none),
+             SCENEFILES_DIR "/intersect/meshes/bunny.obj");
+
+    SceneLightData point{};
+    point.type = LightType::LIGHT_POINT;
+    point.color = glm::vec4(1);
+    point.function = glm::vec3(1, 0, 0);
+    point.pos = glm::vec4(0, 6, 0, 1);
+    point.width = point.height = 0.5f;
+    data.lights.push_back(point);
+
+    SceneLightData directional{};
+    directional.type = LightType::LIGHT_DIRECTIONAL;
+    directional.color = glm::vec4(0.3f);
+    directional.function = glm::vec3(1, 0, 0);
+    directional.dir = glm::vec4(-1, -1, -0.5, 0);
+    data.lights.push_back(directional);
+
+    SceneLightData spot{};
+    spot.type = LightType::LIGHT_SPOT;
+    spot.color = glm::vec4(0.5f);
+    spot.function = glm::vec3(1, 0, 0);
+    spot.pos = glm::vec4(-3, 4, 3, 1);
+    spot.dir = glm::vec4(3, -4, -3, 0);
+    spot.angle = 0.5f;
+    spot.penumbra = 0.2f;
+    spot.width = spot.height = 0.5f;
+    data.lights.push_back(spot);
+
+    return data;
+}
+
+static long countRenderAllocations(RayTracer& raytracer, const RenderData& data, int width, int height) {
+    std::vector<RGBA> image(width * height);
+    RayTraceScene scene{width, height, data};
+
+    long before = allocationCount.load();
+    raytracer.render(image.data(), scene);
+    return allocationCount.load() - before;
+}
+
+// Render the scene after a warm-up at the small and the large size and compare the number of allocations
+static bool checkConfig(const char* name, const RayTracer::Config& config) {
+    const RenderData data = testScene();
+    const int width = 40;
+    const int height = 30;
+
+    RayTracer raytracer{config};
+    countRenderAllocations(raytracer, data, 2 * width, 2 * height);
+    long small = countRenderAllocations(raytracer, data, width, height);
+    long large = countRenderAllocations(raytracer, data, 2 * width, 2 * height);
+
+    bool passed = small == large;
+    std::printf("%-20s %ld allocations at %dx%d, %ld at %dx%d: %s\n", name, small, width, height, large, 2 * width, 2 * height,
+                passed ? "ok" : "FAILED, pixels allocate");
+    return passed;
+}
+
+int main() {
+    // Note: Only the sequential renderer is checked, the parallel one also allocates for its thread pool
+    RayTracer::Config config;
+    config.enableShadow = true;
+    config.enableReflection = true;
+    config.enableRefraction = true;
+    config.enableAcceleration = true;
+
+    bool passed = true;
+    passed &= checkConfig("packets", config);
+
+    RayTracer::Config single = config;
+    single.enableRayPackets = false;
+    passed &= checkConfig("single rays", single);
+
+    RayTracer::Config hardShadows = single;
+    hardShadows.enableSoftShadows = false;
+    passed &= checkConfig("hard shadows", hardShadows);
+
+    RayTracer::Config superSample = config;
+    superSample.enableSuperSample = true;
+    passed &= checkConfig("super-sampling", superSample);
+
+    RayTracer::Config depthOfField = config;
+    depthOfField.enableDepthOfField = true;
+    passed &= checkConfig("depth of field", depthOfField);
+
+    RayTracer::Config wavefront = config;
+    wavefront.enableWavefront = true;
+    passed &= checkConfig("wavefront", wavefront);
+
+    RayTracer::Config noAcceleration = single;
+    noAcceleration.enableAcceleration = false;
+    passed &= checkConfig("no acceleration", noAcceleration);
+
+    return passed ? 0 : 1;
+}